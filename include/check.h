@@ -0,0 +1,100 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        CHECK_NO_TICKET,     // title.list entry without any ticket
+        CHECK_NOT_LISTED,    // Installed title missing from title.list
+        CHECK_NOT_INSTALLED, // Ticket for a title that isn't installed
+        CHECK_KINDS,
+    } CHECK_KIND;
+
+    static inline int compareTids(const void *a, const void *b)
+    {
+        uint64_t x = *(const uint64_t *)a;
+        uint64_t y = *(const uint64_t *)b;
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+
+    // Sorts and removes duplicates, returns the new count
+    static inline size_t sortTids(uint64_t *tids, size_t count)
+    {
+        if(count == 0)
+            return 0;
+
+        qsort(tids, count, sizeof(uint64_t), compareTids);
+        size_t unique = 1;
+        for(size_t i = 1; i < count; ++i)
+            if(tids[i] != tids[unique - 1])
+                tids[unique++] = tids[i];
+
+        return unique;
+    }
+
+    // Merges the sorted TIDs of the tickets, title.list and the installed titles, calling mismatch for every TID
+    // missing from one of them where it's expected. Used on the console and by the host tests.
+    static inline void joinTids(const uint64_t *tickets, size_t ticketCount, const uint64_t *list, size_t listCount, const uint64_t *installed, size_t installedCount,
+                                void (*mismatch)(void *ctx, CHECK_KIND kind, uint64_t tid), void *ctx)
+    {
+        size_t t = 0;
+        size_t l = 0;
+        size_t i = 0;
+        uint64_t tid;
+        bool inTickets;
+        bool inList;
+        bool isInstalled;
+        while(t < ticketCount || l < listCount || i < installedCount)
+        {
+            tid = UINT64_MAX;
+            if(t < ticketCount && tickets[t] < tid)
+                tid = tickets[t];
+            if(l < listCount && list[l] < tid)
+                tid = list[l];
+            if(i < installedCount && installed[i] < tid)
+                tid = installed[i];
+
+            inTickets = t < ticketCount && tickets[t] == tid;
+            inList = l < listCount && list[l] == tid;
+            isInstalled = i < installedCount && installed[i] == tid;
+            t += inTickets;
+            l += inList;
+            i += isInstalled;
+
+            if(inList && !inTickets)
+                mismatch(ctx, CHECK_NO_TICKET, tid);
+            if(isInstalled && !inList)
+                mismatch(ctx, CHECK_NOT_LISTED, tid);
+            if(inTickets && !isInstalled)
+                mismatch(ctx, CHECK_NOT_INSTALLED, tid);
+        }
+    }
+
+#ifdef __cplusplus
+}
+#endif
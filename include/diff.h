@@ -0,0 +1,132 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        DIFF_ADDED,
+        DIFF_REMOVED,
+        DIFF_CHANGED,
+        DIFF_KINDS,
+    } DIFF_KIND;
+
+    typedef enum
+    {
+        INDEX_RECORD_TICKET,
+        INDEX_RECORD_TITLE_LIST,
+        INDEX_RECORD_TYPES,
+    } INDEX_RECORD_TYPE;
+
+    // One per ticket or title.list entry, sorted by type, TID and hash
+    typedef struct
+    {
+        uint64_t tid;
+        uint64_t hash;
+        uint32_t size;
+        uint8_t type;
+        char name[18]; // Relative to the slot, like BACKUP_JOB
+    } INDEX_RECORD;
+
+    static inline int compareIndexKeys(const INDEX_RECORD *a, const INDEX_RECORD *b)
+    {
+        if(a->type != b->type)
+            return a->type < b->type ? -1 : 1;
+
+        return a->tid < b->tid ? -1 : a->tid > b->tid ? 1 : 0;
+    }
+
+    static inline int compareIndexRecords(const void *a, const void *b)
+    {
+        const INDEX_RECORD *x = a;
+        const INDEX_RECORD *y = b;
+        int ret = compareIndexKeys(x, y);
+        if(ret != 0)
+            return ret;
+
+        return x->hash < y->hash ? -1 : x->hash > y->hash ? 1 : 0;
+    }
+
+    static inline size_t indexKeyEnd(const INDEX_RECORD *records, size_t start, size_t count)
+    {
+        size_t end = start + 1;
+        while(end < count && compareIndexKeys(records + start, records + end) == 0)
+            ++end;
+
+        return end;
+    }
+
+    // Both indexes are sorted, so a single merge finds everything added, removed or changed from one to the other.
+    // Every key (type and TID) gets reported once, with the first record of its side. Used on the console and by the host tests.
+    static inline void diffIndexes(const INDEX_RECORD *from, size_t fromCount, const INDEX_RECORD *to, size_t toCount,
+                                   void (*found)(void *ctx, DIFF_KIND kind, const INDEX_RECORD *record), void *ctx)
+    {
+        size_t a = 0;
+        size_t b = 0;
+        size_t aEnd;
+        size_t bEnd;
+        int cmp;
+        bool changed;
+        while(a < fromCount || b < toCount)
+        {
+            if(a == fromCount)
+                cmp = 1;
+            else if(b == toCount)
+                cmp = -1;
+            else
+                cmp = compareIndexKeys(from + a, to + b);
+
+            if(cmp < 0)
+            {
+                found(ctx, DIFF_REMOVED, from + a);
+                a = indexKeyEnd(from, a, fromCount);
+            }
+            else if(cmp > 0)
+            {
+                found(ctx, DIFF_ADDED, to + b);
+                b = indexKeyEnd(to, b, toCount);
+            }
+            else
+            {
+                // Same TID on both sides, changed if the hashes of its tickets differ
+                aEnd = indexKeyEnd(from, a, fromCount);
+                bEnd = indexKeyEnd(to, b, toCount);
+                changed = aEnd - a != bEnd - b;
+                for(size_t i = 0; !changed && i < aEnd - a; ++i)
+                    changed = from[a + i].hash != to[b + i].hash;
+
+                if(changed)
+                    found(ctx, DIFF_CHANGED, to + b);
+
+                a = aEnd;
+                b = bEnd;
+            }
+        }
+    }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,54 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // FNV-1a style, but eating 8 bytes per round. Not cryptographic, just fast and good enough to tell tickets apart.
+    // Used on the console and by the host tools, so the result doesn't depend on the endianness.
+    static inline uint64_t hash64(const uint8_t *data, size_t size)
+    {
+        uint64_t hash = 0xCBF29CE484222325ULL ^ size;
+        uint64_t chunk;
+        size_t i = 0;
+        for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            chunk = 0;
+            for(size_t j = 0; j < sizeof(uint64_t); ++j)
+                chunk = (chunk << 8) | data[i + j];
+
+            hash = (hash ^ chunk) * 0x100000001B3ULL;
+            hash ^= hash >> 29;
+        }
+
+        for(; i < size; ++i)
+            hash = (hash ^ data[i]) * 0x100000001B3ULL;
+
+        return hash ^ (hash >> 32);
+    }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <coreinit/memdefaultheap.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// uint64_t -> void * hash map with open addressing (linear probing). There's no removal, we don't need it.
+
+#define MAP_INITIAL_CAPACITY 256
+
+    typedef struct
+    {
+        uint64_t key;
+        void *value;
+        bool used;
+    } MAP_ENTRY;
+
+    typedef struct
+    {
+        MAP_ENTRY *entries;
+        size_t capacity;
+        size_t size;
+    } MAP;
+
+    static inline size_t mapSlot(uint64_t key, size_t capacity)
+    {
+        // Fibonacci hashing, TIDs and hashes alike have most entropy in the lower bits
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+    }
+
+    static inline MAP *createMap()
+    {
+        MAP *ret = MEMAllocFromDefaultHeap(sizeof(MAP));
+        if(ret != NULL)
+        {
+            ret->entries = MEMAllocFromDefaultHeap(sizeof(MAP_ENTRY) * MAP_INITIAL_CAPACITY);
+            if(ret->entries == NULL)
+            {
+                MEMFreeToDefaultHeap(ret);
+                return NULL;
+            }
+
+            for(size_t i = 0; i < MAP_INITIAL_CAPACITY; ++i)
+                ret->entries[i].used = false;
+
+            ret->capacity = MAP_INITIAL_CAPACITY;
+            ret->size = 0;
+        }
+        return ret;
+    }
+
+    static inline void destroyMap(MAP *map, bool freeContents)
+    {
+        if(freeContents)
+            for(size_t i = 0; i < map->capacity; ++i)
+                if(map->entries[i].used)
+                    MEMFreeToDefaultHeap(map->entries[i].value);
+
+        MEMFreeToDefaultHeap(map->entries);
+        MEMFreeToDefaultHeap(map);
+    }
+
+    static inline MAP_ENTRY *findMapEntry(MAP_ENTRY *entries, size_t capacity, uint64_t key)
+    {
+        size_t i = mapSlot(key, capacity);
+        while(entries[i].used && entries[i].key != key)
+            i = (i + 1) & (capacity - 1);
+
+        return entries + i;
+    }
+
+    static inline void *getFromMap(MAP *map, uint64_t key)
+    {
+        MAP_ENTRY *entry = findMapEntry(map->entries, map->capacity, key);
+        return entry->used ? entry->value : NULL;
+    }
+
+    // Adds or replaces the value for key
+    static inline bool addToMap(MAP *map, uint64_t key, void *value)
+    {
+        // Keep the load factor below 3/4
+        if((map->size + 1) * 4 > map->capacity * 3)
+        {
+            size_t capacity = map->capacity * 2;
+            MAP_ENTRY *entries = MEMAllocFromDefaultHeap(sizeof(MAP_ENTRY) * capacity);
+            if(entries == NULL)
+                return false;
+
+            for(size_t i = 0; i < capacity; ++i)
+                entries[i].used = false;
+
+            for(size_t i = 0; i < map->capacity; ++i)
+                if(map->entries[i].used)
+                    *findMapEntry(entries, capacity, map->entries[i].key) = map->entries[i];
+
+            MEMFreeToDefaultHeap(map->entries);
+            map->entries = entries;
+            map->capacity = capacity;
+        }
+
+        MAP_ENTRY *entry = findMapEntry(map->entries, map->capacity, key);
+        if(!entry->used)
+        {
+            entry->used = true;
+            entry->key = key;
+            map->size++;
+        }
+
+        entry->value = value;
+        return true;
+    }
+
+#define forEachMapEntry(x, y) for(size_t curEntry = 0; curEntry < x->capacity; ++curEntry) if(x->entries[curEntry].used && (y = x->entries[curEntry].value))
+
+#define getMapSize(x) (x->size)
+
+#ifdef __cplusplus
+}
+#endif
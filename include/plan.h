@@ -0,0 +1,131 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <hash.h>
+#include <ticket.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PLAN_MAGIC 0x54504C4E // "TPLN"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        size_t offset;
+        size_t size;
+    } TICKET_SECTION;
+
+    typedef enum
+    {
+        PLAN_RECORD_FILE,
+        PLAN_RECORD_TITLE_LIST,
+    } PLAN_RECORD_TYPE;
+
+    // The plan file starts with PLAN_MAGIC, followed by these records. File records are followed by keptCount + removedCount
+    // TICKET_SECTIONs (kept ones first) and uninstalledCount TIDs, the ones removed for not being installed. The title.list
+    // record is followed by removedCount TIDs to drop, all of them not installed.
+    typedef struct
+    {
+        uint64_t hash; // hash64() of the file at planning time, the plan is outdated if that changed
+        uint32_t type;
+        uint32_t size;
+        uint32_t keptCount;
+        uint32_t removedCount;
+        uint32_t uninstalledCount;
+        char name[18]; // Relative to TICKET_BUCKET, empty for title.list
+    } PLAN_RECORD;
+
+    // In 64 bits, so corrupted counts can't wrap
+    static inline uint64_t planRecordDataSize(const PLAN_RECORD *record)
+    {
+        if(record->type == PLAN_RECORD_FILE)
+            return ((uint64_t)record->keptCount + record->removedCount) * sizeof(TICKET_SECTION) + (uint64_t)record->uninstalledCount * sizeof(uint64_t);
+
+        return (uint64_t)record->removedCount * sizeof(uint64_t);
+    }
+
+    // Checks the structure of the plan only, without touching any file. Used on the console and by the host tests.
+    static inline bool checkPlan(const uint8_t *plan, size_t size)
+    {
+        if(size < sizeof(uint32_t) || *(const uint32_t *)plan != PLAN_MAGIC)
+            return false;
+
+        const PLAN_RECORD *record;
+        const TICKET_SECTION *sections;
+        bool titleList = false;
+        size_t count;
+        for(size_t i = sizeof(uint32_t); i < size; i += count)
+        {
+            if(size - i < sizeof(PLAN_RECORD))
+                return false;
+
+            record = (const PLAN_RECORD *)(plan + i);
+            i += sizeof(PLAN_RECORD);
+            if(record->type > PLAN_RECORD_TITLE_LIST || record->name[sizeof(record->name) - 1] != '\0' || planRecordDataSize(record) > size - i)
+                return false;
+
+            count = planRecordDataSize(record);
+            if(record->type == PLAN_RECORD_TITLE_LIST)
+            {
+                // There's one title.list only
+                if(titleList || record->keptCount != 0 || record->uninstalledCount != 0)
+                    return false;
+
+                titleList = true;
+                continue;
+            }
+
+            if(record->removedCount == 0 || record->name[0] == '\0' || record->uninstalledCount > record->removedCount)
+                return false;
+
+            // Every section has to be a whole ticket inside of the file
+            sections = (const TICKET_SECTION *)(plan + i);
+            for(size_t j = 0; j < record->keptCount + record->removedCount; ++j)
+                if(sections[j].size < sizeof(TICKET) || sections[j].offset > record->size || record->size - sections[j].offset < sections[j].size)
+                    return false;
+        }
+
+        return true;
+    }
+
+    // Number of records of a plan checkPlan() accepted
+    static inline size_t planRecordCount(const uint8_t *plan, size_t size)
+    {
+        size_t records = 0;
+        for(size_t i = sizeof(uint32_t); i < size; ++records)
+            i += sizeof(PLAN_RECORD) + planRecordDataSize((const PLAN_RECORD *)(plan + i));
+
+        return records;
+    }
+
+    // False if the file changed since the plan got made
+    static inline bool isPlannedFile(const PLAN_RECORD *record, const uint8_t *file, size_t size)
+    {
+        return size == record->size && hash64(file, size) == record->hash;
+    }
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,65 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // The ticket that survives for a TID with select=best
+    typedef struct
+    {
+        uint64_t file; // See ticketFileKey()
+        size_t offset;
+        uint64_t ticketId;
+        uint16_t version;
+    } BEST_TICKET;
+
+    // Bucket and the hex name of a ticket file, unique inside of the ticket bucket
+    static inline uint64_t ticketFileKey(uint16_t bucket, const char *name)
+    {
+        return (((uint64_t)bucket) << 32) | strtoul(name, NULL, 16);
+    }
+
+    // First pass: the highest title version wins, then the highest ticket ID. first is set for a new BEST_TICKET.
+    static inline void offerBestTicket(BEST_TICKET *best, bool first, uint16_t bucket, const char *name, size_t offset, uint64_t ticketId, uint16_t version)
+    {
+        if(!first && (version < best->version || (version == best->version && ticketId <= best->ticketId)))
+            return;
+
+        best->file = ticketFileKey(bucket, name);
+        best->offset = offset;
+        best->ticketId = ticketId;
+        best->version = version;
+    }
+
+    // Second pass: true if the ticket at offset of the file is the one to keep. best is NULL if the first pass didn't see the TID.
+    static inline bool isBestTicket(const BEST_TICKET *best, uint16_t bucket, const char *name, size_t offset)
+    {
+        return best != NULL && best->file == ticketFileKey(bucket, name) && best->offset == offset;
+    }
+
+#ifdef __cplusplus
+}
+#endif
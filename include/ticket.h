@@ -19,7 +19,17 @@
 
 #include <stdint.h>
 
+#ifdef __WUT__
 #include <wut_structsize.h>
+#else
+// Just enough of wut_structsize.h to share this layout with the host tools
+#define WUT_PACKED                            __attribute__((__packed__))
+#define WUT_PP_CAT(a, b)                      WUT_PP_CAT_I(a, b)
+#define WUT_PP_CAT_I(a, b)                    a##b
+#define WUT_UNKNOWN_BYTES(size)               char WUT_PP_CAT(__unk, __COUNTER__)[size]
+#define WUT_CHECK_OFFSET(type, offset, field) _Static_assert(__builtin_offsetof(type, field) == (offset), #type "." #field " at wrong offset")
+#define WUT_CHECK_SIZE(type, size)            _Static_assert(sizeof(type) == (size), #type " has wrong size")
+#endif
 
 #ifdef __cplusplus
 extern "C"
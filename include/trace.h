@@ -0,0 +1,80 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/mcp.h>
+#include <coreinit/time.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum
+    {
+        TRACE_OP_OPEN,
+        TRACE_OP_OPEN_DIR,
+        TRACE_OP_READ,
+        TRACE_OP_WRITE,
+        TRACE_OP_REMOVE,
+        TRACE_OP_READ_DIR,
+        TRACE_OP_TITLE_INFO,
+    } TRACE_OP;
+
+    extern bool tracing;
+
+    bool traceInit();
+    void traceEvent(TRACE_OP op, const char *path, int32_t handle, uint32_t bytes, uint64_t tid, int32_t result, OSTime start);
+    FSError traceFlush(FSAClientHandle client, char *path);
+
+#ifndef TRACE_NO_WRAPPERS
+// Route the calls we want to see in the trace through traceEvent(). This costs a single branch while tracing is off.
+#define TRACED(op, path, handle, bytes, tid, call)                                                   \
+    ({                                                                                               \
+        OSTime traceStart = tracing ? OSGetSystemTime() : 0;                                         \
+        __typeof__(call) traceRet = call;                                                            \
+        if(tracing)                                                                                  \
+            traceEvent(op, path, handle, bytes, tid, (int32_t)traceRet, traceStart);                 \
+        traceRet;                                                                                    \
+    })
+
+#define FSAOpenFileEx(client, path, mode, createMode, flags, prealloc, handle) \
+    TRACED(TRACE_OP_OPEN, path, *(handle), 0, 0, FSAOpenFileEx(client, path, mode, createMode, flags, prealloc, handle))
+#define FSAOpenDir(client, path, handle) \
+    TRACED(TRACE_OP_OPEN_DIR, path, *(handle), 0, 0, FSAOpenDir(client, path, handle))
+#define FSAReadFile(client, buffer, size, count, handle, flags) \
+    TRACED(TRACE_OP_READ, NULL, handle, (size) * (count), 0, FSAReadFile(client, buffer, size, count, handle, flags))
+#define FSAReadFileWithPos(client, buffer, size, count, pos, handle, flags) \
+    TRACED(TRACE_OP_READ, NULL, handle, (size) * (count), 0, FSAReadFileWithPos(client, buffer, size, count, pos, handle, flags))
+#define FSAWriteFile(client, buffer, size, count, handle, flags) \
+    TRACED(TRACE_OP_WRITE, NULL, handle, (size) * (count), 0, FSAWriteFile(client, buffer, size, count, handle, flags))
+#define FSARemove(client, path) \
+    TRACED(TRACE_OP_REMOVE, path, 0, 0, 0, FSARemove(client, path))
+#define FSAReadDir(client, handle, entry) \
+    TRACED(TRACE_OP_READ_DIR, NULL, handle, 0, 0, FSAReadDir(client, handle, entry))
+#define MCP_GetTitleInfo(handle, tid, info) \
+    TRACED(TRACE_OP_TITLE_INFO, NULL, 0, 0, tid, MCP_GetTitleInfo(handle, tid, info))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,8 +16,15 @@
  * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  *
  ***************************************************************************/
 
+#include <check.h>
+#include <diff.h>
+#include <hash.h>
 #include <list.h>
+#include <map.h>
+#include <plan.h>
+#include <select.h>
 #include <ticket.h>
+#include <trace.h>
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -30,6 +37,9 @@
 #include <coreinit/mcp.h>
 #include <coreinit/memdefaultheap.h>
 #include <coreinit/memory.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
 #include <coreinit/title.h>
 #include <mocha/mocha.h>
 #include <proc_ui/procui.h>
@@ -48,12 +58,110 @@
 #define isDLC(tid)       (((uint32_t)(tid >> 32)) == 0x0005000C)
 #define WRITE_BUFSIZE    (1024 * 1024) // 1 MB
 #define MAX_LINES        16
+#define UNDO_PATH        SD_PATH "/undo.log"
+#define UNDO_BUFSIZE     (64 * 1024) // 64 KB
+#define TRACE_PATH       SD_PATH "/trace.json"
+#define MAX_BACKUP_TARGETS 4
+#define BACKUP_QUEUE_SIZE  256 // Default depth of a target's queue, "depth = n" after a target line changes it
+#define MAX_BACKUP_QUEUE_SIZE 4096
+#define MAX_PENDING_BUCKETS 64
+#define BACKUP_STACK_SIZE  (16 * 1024) // 16 KB
+#define BATCH_PATH       SD_PATH "/batch.cfg"
+#define BATCH_LOG_PATH   SD_PATH "/batch.log"
+#define BATCH_LOG_SIZE   (16 * 1024) // 16 KB
+#define MAX_BATCH_OPS    16
+#define MAX_BATCH_LINE   64
+#define CHECKPOINT_PATH  SD_PATH "/checkpoint.bin"
+#define CHECKPOINT_MAGIC 0x54434B50 // "TCKP"
+#define MAX_CHECKPOINT_BUCKETS 256
+#define CHECKPOINT_NO_SLOT 0xFFFF
+#define PLAN_PATH        SD_PATH "/plan.bin"
+#define PLAN_BUFSIZE     (64 * 1024) // 64 KB
+#define CHECK_PATH       SD_PATH "/check.txt"
+#define DIFF_PATH        SD_PATH "/diff.txt"
+#define INDEX_NAME       "index.bin"
+#define INDEX_MAGIC      0x54494432 // "TID2"
+#define DIFF_NEWEST      0xFFFF
 
 typedef struct
 {
-    uint8_t *start;
+    FSAFileHandle handle;
+    uint8_t *buffer;
+    size_t size;
+    size_t fill;
+} WRITER;
+
+typedef enum
+{
+    BACKUP_JOB_DIR,
+    BACKUP_JOB_TICKET,
+    BACKUP_JOB_FILE,
+} BACKUP_JOB_TYPE;
+
+// A file read from the SLC, shared by all backup targets. The last one done with it frees it.
+typedef struct
+{
+    BACKUP_JOB_TYPE type;
+    uint32_t refs;
+    uint32_t targets;  // Targets it got queued to
+    uint32_t finished; // Targets done with it, successful or not
+    uint32_t written;  // Targets which wrote it successfully
+    void *buffer;
+    size_t size;
+    char name[18]; // Relative to the slot: "0000", "0000/00000000.tik" or "title.list"
+} BACKUP_JOB;
+
+typedef struct
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40)));
+    size_t baseLen;
+    size_t pathLen;
+    bool running;
+    FSAClientHandle client;
+    OSThread thread __attribute__((__aligned__(8)));
+    void *stack;
+    OSMessageQueue queue;
+    OSMessage *messages;
+    uint32_t depth; // 0 for BACKUP_QUEUE_SIZE
+    uint16_t slot;
+    uint32_t queued;
+    uint32_t processed;
+    size_t files;
+    size_t stalls;
+    OSTime busy;
+    FSError result;
+} BACKUP_TARGET;
+
+typedef enum
+{
+    UNDO_RECORD_TICKET,
+    UNDO_RECORD_TITLE,
+} UNDO_RECORD_TYPE;
+
+// Followed by pathSize bytes of path (including the '\0', none for title.list entries) and dataSize bytes of data
+typedef struct
+{
+    uint32_t type;
+    uint32_t pathSize;
+    uint32_t dataSize;
+} UNDO_RECORD;
+
+// Copy of a DLC ticket we kept, to find byte identical ones
+typedef struct DLC_TICKET DLC_TICKET;
+struct DLC_TICKET
+{
+    DLC_TICKET *next; // Same hash but different bytes
     size_t size;
-} TICKET_SECTION;
+    uint8_t data[];
+};
+
+// What the selection pass learned about a ticket file
+typedef struct
+{
+    uint32_t candidates; // Installed non-DLC tickets
+    uint32_t winners;    // Candidates that are the best ticket for their TID
+    bool uninstalled;
+} TICKET_FILE_STATE;
 
 typedef struct TITLE_LIST_ENTRY TITLE_LIST_ENTRY;
 struct TITLE_LIST_ENTRY
@@ -62,6 +170,107 @@ struct TITLE_LIST_ENTRY
     TITLE_LIST_ENTRY *next;
 };
 
+// Callbacks for walkBucket(), path holds the directory or file they get called for. Failures set error.
+typedef struct
+{
+    bool (*enterDir)(void *ctx, char *path, uint16_t bucket); // Optional, false skips the directory
+    void (*file)(void *ctx, char *path, const FSADirectoryEntry *entry);
+    void (*leaveDir)(void *ctx, uint16_t bucket); // Optional, only called without errors
+} BUCKET_WALKER;
+
+// State of the select=best pass
+typedef struct
+{
+    MAP *bestTickets;
+    MAP *fileStates;
+    MAP *titleStates;
+    TICKET_FILE_STATE *state; // Of the current file, NULL for finished buckets
+    uint64_t fileKey;
+    const char *name; // Of the current file
+    uint16_t bucket;
+    bool done;
+} SELECT_WALK;
+
+// State of the cleanup walk
+typedef struct
+{
+    bool dryRun;
+    bool logUndo;
+    bool sparse;
+    LIST *handledIds;
+    LIST *ticketList;
+    LIST *removedList;
+    LIST *uninstalledList;
+    MAP *dlcTickets;
+    MAP *bestTickets;
+    MAP *fileStates;
+    MAP *titleStates;
+    uint16_t bucket;
+    bool done;
+} CLEANUP_WALK;
+
+// TIDs collected with addTid()
+typedef struct
+{
+    uint64_t *tids;
+    size_t count;
+    size_t capacity;
+} TID_ARRAY;
+
+// Cached as INDEX_NAME inside of the slot. If the files, bytes or stamp of the slot differ it's outdated.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t files;
+    uint64_t bytes;
+    uint64_t stamp; // See stampIndexFile()
+    uint32_t count;
+} INDEX_HEADER;
+
+// State of indexSlot()
+typedef struct
+{
+    INDEX_HEADER *header;
+    INDEX_RECORD **records;
+    size_t capacity;
+    const char *inSlot;
+} INDEX_WALK;
+
+typedef enum
+{
+    CHECKPOINT_OP_BACKUP,
+    CHECKPOINT_OP_CLEANUP,
+} CHECKPOINT_OP;
+
+#define CHECKPOINT_FLAG_UNDO      (1 << 0)
+#define CHECKPOINT_FLAG_DLCDEDUPE (1 << 1)
+#define CHECKPOINT_FLAG_SELECTBEST (1 << 2)
+
+// Written to the SD card after every finished bucket, so an interrupted run can continue where it stopped
+typedef struct
+{
+    uint32_t magic;
+    uint32_t op;
+    uint32_t flags;
+    uint32_t targetCount;
+    uint16_t slots[MAX_BACKUP_TARGETS];
+    char targets[MAX_BACKUP_TARGETS][FS_MAX_PATH]; // Base paths, a resumed backup needs the same ones
+    uint32_t files;
+    uint32_t dlcDuplicates;
+    uint64_t bytesRead;
+    uint16_t bucketCount;
+    uint16_t buckets[MAX_CHECKPOINT_BUCKETS];
+} CHECKPOINT;
+
+// A bucket the backup walk left while some targets might still be writing its files
+typedef struct
+{
+    uint16_t bucket;
+    uint32_t files;
+    uint64_t bytesRead;
+    uint32_t queued[MAX_BACKUP_TARGETS]; // BACKUP_TARGET.queued when the walk left the bucket
+} PENDING_BUCKET;
+
 typedef enum
 {
     LOOP_STATE_MAIN_MENU,
@@ -69,19 +278,74 @@ typedef enum
     LOOP_STATE_DELETED,
     LOOP_STATE_BACKING_UP,
     LOOP_STATE_BACKUPED,
+    LOOP_STATE_UNDOING,
+    LOOP_STATE_UNDONE,
+    LOOP_STATE_RESUMING,
+    LOOP_STATE_MAINTAINING,
+    LOOP_STATE_MAINTAINED,
+    LOOP_STATE_CHECKING,
+    LOOP_STATE_CHECKED,
+    LOOP_STATE_DIFFING,
+    LOOP_STATE_DIFFED,
     LOOP_STATE_INVALID,
 } LOOP_STATE;
 
+typedef enum
+{
+    BATCH_OP_BACKUP,
+    BATCH_OP_CLEANUP,
+    BATCH_OP_VERIFY,
+    BATCH_OP_UNDO,
+    BATCH_OP_RESUME,
+    BATCH_OP_PLAN,
+    BATCH_OP_APPLY,
+    BATCH_OP_MAINTAIN,
+    BATCH_OP_CHECK,
+    BATCH_OP_DIFF,
+} BATCH_OP;
+
 static FSAClientHandle fsaClient;
 static int mcpHandle;
 
-static FSAFileHandle fileHandle;
-static uint8_t *writeBuffer;
-static size_t writeBufferFill = 0;
+static WRITER writer = { .size = WRITE_BUFSIZE };
+static WRITER undoWriter = { .size = UNDO_BUFSIZE };
+static WRITER planWriter = { .size = PLAN_BUFSIZE };
+
+static BACKUP_TARGET backupTargets[MAX_BACKUP_TARGETS];
+static size_t backupTargetCount = 0;
+static PENDING_BUCKET pendingBuckets[MAX_PENDING_BUCKETS];
+static size_t pendingBucketCount;
 
 static size_t arg0;
 static size_t arg1;
 static bool error = false;
+static bool exiting = false;
+static bool sparseScan = true;
+static bool undoLog = false; // Optional, needs a writable SD card: undo = 1 in batch.cfg
+static bool traceCalls = false;
+static bool dlcDedupe = false;
+static bool selectBest = false;
+static bool fusedBackup = false;
+static size_t dlcDuplicates;
+static uint64_t bytesRead;
+
+static CHECKPOINT checkpoint __attribute__((__aligned__(0x40)));
+static bool resuming = false;
+static uint8_t userFlags; // CHECKPOINT_FLAG_* of the options loadCheckpoint() replaced
+static bool userFlagsSaved = false;
+static bool planning = false;
+static size_t plannedFiles;
+static size_t checkCounts[CHECK_KINDS];
+static bool checkWritten;
+static size_t diffCounts[INDEX_RECORD_TYPES][DIFF_KINDS];
+static uint16_t diffSlots[2];
+static size_t cachedIndexes;
+
+static BATCH_OP batchOps[MAX_BATCH_OPS];
+static uint16_t batchDiffSlots[MAX_BATCH_OPS][2];
+static size_t batchOpCount = 0;
+static char *batchLog;
+static size_t batchLogFill = 0;
 
 static void clearScreen()
 {
@@ -115,6 +379,7 @@ static FSError readFile(const char *path, void **buffer, size_t size)
             err = FSAReadFile(fsaClient, *buffer, size, 1, handle, 0);
             if(err == 1)
             {
+                bytesRead += size;
                 FSACloseFile(fsaClient, handle);
                 return FS_ERROR_OK;
             }
@@ -130,600 +395,3290 @@ static FSError readFile(const char *path, void **buffer, size_t size)
     return err;
 }
 
-static FSError writeTicket(const uint8_t *buffer, size_t size)
+static FSError writeTicket(WRITER *out, const uint8_t *buffer, size_t size)
 {
-    size_t newBufSize = writeBufferFill + size;
-    if(newBufSize < WRITE_BUFSIZE)
+    size_t newBufSize = out->fill + size;
+    if(newBufSize < out->size)
     {
-        OSBlockMove(writeBuffer + writeBufferFill, buffer, size, false);
-        writeBufferFill = newBufSize;
+        OSBlockMove(out->buffer + out->fill, buffer, size, false);
+        out->fill = newBufSize;
         return FS_ERROR_OK;
     }
 
-    newBufSize -= WRITE_BUFSIZE;
-    OSBlockMove(writeBuffer + writeBufferFill, buffer, size - newBufSize, false);
-    FSError ret = FSAWriteFile(fsaClient, writeBuffer, WRITE_BUFSIZE, 1, fileHandle, 0);
+    newBufSize -= out->size;
+    OSBlockMove(out->buffer + out->fill, buffer, size - newBufSize, false);
+    FSError ret = FSAWriteFile(fsaClient, out->buffer, out->size, 1, out->handle, 0);
     if(ret != 1)
     {
-        FSACloseFile(fsaClient, fileHandle);
+        FSACloseFile(fsaClient, out->handle);
         return ret;
     }
 
-    writeBufferFill = 0;
-    return newBufSize != 0 ? writeTicket(buffer + (size - newBufSize), newBufSize) : FS_ERROR_OK;
+    out->fill = 0;
+    return newBufSize != 0 ? writeTicket(out, buffer + (size - newBufSize), newBufSize) : FS_ERROR_OK;
 }
 
-static FSError closeTicket()
+// Writes out whatever is buffered without closing the file
+static FSError flushTicket(WRITER *out)
 {
-    if(writeBufferFill != 0)
+    if(out->fill != 0)
     {
-        FSError ret = FSAWriteFile(fsaClient, writeBuffer, writeBufferFill, 1, fileHandle, 0);
+        FSError ret = FSAWriteFile(fsaClient, out->buffer, out->fill, 1, out->handle, 0);
         if(ret != 1)
         {
-            FSACloseFile(fsaClient, fileHandle);
+            FSACloseFile(fsaClient, out->handle);
             return ret;
         }
 
-        writeBufferFill = 0;
+        out->fill = 0;
     }
 
-    return FSACloseFile(fsaClient, fileHandle);
+    return FS_ERROR_OK;
 }
 
-static void cleanTitleList()
+static FSError closeTicket(WRITER *out)
 {
-    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_LIST_PATH;
-    FSStat stat;
-    FSError ret = FSAGetStat(fsaClient, path, &stat);
+    FSError ret = flushTicket(out);
+    return ret == FS_ERROR_OK ? FSACloseFile(fsaClient, out->handle) : ret;
+}
+
+static bool openUndoLog()
+{
+    undoWriter.buffer = MEMAllocFromDefaultHeapEx(FS_ALIGN(UNDO_BUFSIZE), 0x40);
+    if(undoWriter.buffer == NULL)
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+        return false;
+    }
+
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+    FSAMakeDir(fsaClient, path, 0x660);
+    strcpy(path, UNDO_PATH);
+    FSError ret = FSAOpenFileEx(fsaClient, path, "a", 0x660, FS_OPEN_FLAG_NONE, 0, &undoWriter.handle);
     if(ret != FS_ERROR_OK)
     {
-        WHBLogPrintf("Error stating %s", path);
+        WHBLogPrintf("Error opening %s", path);
         WHBLogPrint(FSAGetStatusStr(ret));
         error = true;
-        return;
+        MEMFreeToDefaultHeap(undoWriter.buffer);
+        undoWriter.buffer = NULL;
+        return false;
     }
 
-    uint64_t *file;
-    ret = readFile(path, (void **)&file, stat.size);
+    undoWriter.fill = 0;
+    return true;
+}
+
+static void writeUndoRecord(UNDO_RECORD_TYPE type, const char *path, const uint8_t *data, size_t size)
+{
+    UNDO_RECORD record = {
+        .type = type,
+        .pathSize = path == NULL ? 0 : strlen(path) + 1,
+        .dataSize = size,
+    };
+
+    FSError ret = writeTicket(&undoWriter, (uint8_t *)&record, sizeof(UNDO_RECORD));
+    if(ret == FS_ERROR_OK && path != NULL)
+        ret = writeTicket(&undoWriter, (const uint8_t *)path, record.pathSize);
+    if(ret == FS_ERROR_OK)
+        ret = writeTicket(&undoWriter, data, size);
+
     if(ret != FS_ERROR_OK)
     {
-        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrintf("Error writing %s", UNDO_PATH);
         WHBLogPrint(FSAGetStatusStr(ret));
+        // writeTicket() closed the file already
+        MEMFreeToDefaultHeap(undoWriter.buffer);
+        undoWriter.buffer = NULL;
         error = true;
-        return;
     }
+}
 
-    TITLE_LIST_ENTRY *titleList = NULL;
-    TITLE_LIST_ENTRY *cur = NULL;
-    TITLE_LIST_ENTRY *last = NULL;
-    arg1 = 0;
-    MCPTitleListType titleEntry __attribute__((__aligned__(0x40)));
-    for(size_t i = 0; i < stat.size / sizeof(uint64_t); ++i)
+// Makes sure the undo records are on the SD card before the SLC gets touched
+static void flushUndoLog()
+{
+    FSError ret = flushTicket(&undoWriter);
+    if(ret != FS_ERROR_OK)
     {
-        if(isSystemTitle(file[i]) || MCP_GetTitleInfo(mcpHandle, file[i], &titleEntry) == 0)
-        {
-            cur = MEMAllocFromDefaultHeap(sizeof(TITLE_LIST_ENTRY));
-            if(cur == NULL)
-            {
-                WHBLogPrint("EOM!");
-                error = true;
-                break;
-            }
-
-            cur->tid = file[i];
-            cur->next = NULL;
+        WHBLogPrintf("Error writing %s", UNDO_PATH);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        MEMFreeToDefaultHeap(undoWriter.buffer);
+        undoWriter.buffer = NULL;
+        error = true;
+    }
+}
 
-            if(last == NULL)
-                titleList = cur;
-            else
-            {
-                last->next = cur;
-                last = cur;
-            }
+static void closeUndoLog()
+{
+    if(undoWriter.buffer == NULL)
+        return;
 
-            last = cur;
-        }
-        else
-            ++arg1;
+    FSError ret = closeTicket(&undoWriter);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error closing %s", UNDO_PATH);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
     }
 
-    MEMFreeToDefaultHeap(file);
+    MEMFreeToDefaultHeap(undoWriter.buffer);
+    undoWriter.buffer = NULL;
+}
 
-    if(arg1 != 0)
+static bool openPlan()
+{
+    planWriter.buffer = MEMAllocFromDefaultHeapEx(FS_ALIGN(PLAN_BUFSIZE), 0x40);
+    if(planWriter.buffer == NULL)
     {
-        ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &fileHandle);
-        if(ret == FS_ERROR_OK)
-        {
-            for(TITLE_LIST_ENTRY *cur = titleList; cur != NULL; cur = cur->next)
-            {
-                ret = writeTicket((uint8_t *)&(cur->tid), sizeof(uint64_t));
-                if(ret != FS_ERROR_OK)
-                {
-                    WHBLogPrintf("Error writing %s", path);
-                    WHBLogPrint(FSAGetStatusStr(ret));
-                    error = true;
-                    break;
-                }
-            }
+        WHBLogPrint("EOM!");
+        error = true;
+        return false;
+    }
 
-            ret = closeTicket();
-            if(ret != FS_ERROR_OK)
-            {
-                WHBLogPrintf("Error closing %s", path);
-                WHBLogPrint(FSAGetStatusStr(ret));
-                error = true;
-            }
-        }
-        else
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+    FSAMakeDir(fsaClient, path, 0x660);
+    strcpy(path, PLAN_PATH);
+    FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &planWriter.handle);
+    if(ret == FS_ERROR_OK)
+    {
+        planWriter.fill = 0;
+        uint32_t magic = PLAN_MAGIC;
+        ret = writeTicket(&planWriter, (uint8_t *)&magic, sizeof(uint32_t));
+        if(ret == FS_ERROR_OK)
         {
-            WHBLogPrintf("Error opening %s", path);
-            WHBLogPrint(FSAGetStatusStr(ret));
-            error = true;
+            plannedFiles = 0;
+            planning = true;
+            return true;
         }
     }
 
-    for(; titleList != NULL; titleList = titleList->next)
-        MEMFreeToDefaultHeap(titleList);
+    WHBLogPrintf("Error writing %s", path);
+    WHBLogPrint(FSAGetStatusStr(ret));
+    MEMFreeToDefaultHeap(planWriter.buffer);
+    planWriter.buffer = NULL;
+    error = true;
+    return false;
 }
 
-static void backupTickets()
+static void writePlan(const void *data, size_t size)
 {
-    char sdPath[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
-    char *inSD = sdPath + strlen(SD_PATH);
-    FSAMakeDir(fsaClient, sdPath, 0x660);
-    FSADirectoryHandle dir;
-    FSError ret = FSAOpenDir(fsaClient, sdPath, &dir);
+    if(!planning)
+        return;
+
+    FSError ret = writeTicket(&planWriter, (const uint8_t *)data, size);
     if(ret != FS_ERROR_OK)
     {
-        WHBLogPrintf("Error opening %s", sdPath);
+        WHBLogPrintf("Error writing %s", PLAN_PATH);
         WHBLogPrint(FSAGetStatusStr(ret));
+        // writeTicket() closed the file already
+        MEMFreeToDefaultHeap(planWriter.buffer);
+        planWriter.buffer = NULL;
+        planning = false;
         error = true;
-        return;
     }
+}
 
-    // Loop through all the folders to find a free slot
-    uint16_t slot = 0;
-    uint16_t current;
-    FSADirectoryEntry entry;
-    while(!error && FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
-    {
-        if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
-            continue;
+static void writePlanFile(const char *name, const uint8_t *file, size_t size, LIST *ticketList, LIST *removedList, LIST *uninstalledList)
+{
+    PLAN_RECORD record = {
+        .hash = hash64(file, size),
+        .type = PLAN_RECORD_FILE,
+        .size = size,
+        .keptCount = getListSize(ticketList),
+        .removedCount = getListSize(removedList),
+        .uninstalledCount = getListSize(uninstalledList),
+    };
+    strcpy(record.name, name);
+    writePlan(&record, sizeof(PLAN_RECORD));
+
+    TICKET_SECTION *sec;
+    forEachListEntry(ticketList, sec)
+        writePlan(sec, sizeof(TICKET_SECTION));
+    forEachListEntry(removedList, sec)
+        writePlan(sec, sizeof(TICKET_SECTION));
+
+    uint64_t *tid;
+    forEachListEntry(uninstalledList, tid)
+        writePlan(tid, sizeof(uint64_t));
+
+    ++plannedFiles;
+}
 
-        current = strtol(entry.name, NULL, 16);
-        if(++current > slot)
-            slot = current;
-    }
+static void closePlan()
+{
+    if(planWriter.buffer == NULL)
+        return;
 
-    FSACloseDir(fsaClient, dir);
-    sprintf(inSD, "/%04X", slot);
-    ret = FSAMakeDir(fsaClient, sdPath, 0x660);
+    FSError ret = closeTicket(&planWriter);
     if(ret != FS_ERROR_OK)
     {
-        WHBLogPrintf("Error creating %s", sdPath);
+        WHBLogPrintf("Error closing %s", PLAN_PATH);
         WHBLogPrint(FSAGetStatusStr(ret));
         error = true;
-        return;
     }
 
-    inSD += 5;
-    *inSD = '/';
-    ++inSD;
+    MEMFreeToDefaultHeap(planWriter.buffer);
+    planWriter.buffer = NULL;
+    planning = false;
+}
 
-    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
-    char *inSentence = path + strlen(TICKET_BUCKET);
-    void *file;
-    ret = FSAOpenDir(fsaClient, path, &dir);
+static void writeCheckpoint()
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = CHECKPOINT_PATH;
+    FSAFileHandle handle;
+    FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &handle);
     if(ret == FS_ERROR_OK)
     {
-        FSADirectoryHandle dir2;
-        char *fileName;
-        char *inSD2 = inSD + 4;
-        arg0 = 0;
+        ret = FSAWriteFile(fsaClient, &checkpoint, sizeof(CHECKPOINT), 1, handle, 0);
+        if(ret == 1)
+            ret = FSACloseFile(fsaClient, handle);
+        else
+            FSACloseFile(fsaClient, handle);
+    }
 
-        // Loop through all the folder inside of the ticket bucket
-        while(!error && FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
-        {
-            if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
-                continue;
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error writing %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+    }
+}
 
-            strcpy(inSentence, entry.name);
-            ret = FSAOpenDir(fsaClient, path, &dir2);
-            if(ret != FS_ERROR_OK)
-            {
-                WHBLogPrintf("Error opening %s", path);
-                WHBLogPrint(FSAGetStatusStr(ret));
-                error = true;
-                break;
-            }
+static void beginCheckpoint(CHECKPOINT_OP op)
+{
+    OSBlockSet(&checkpoint, 0, sizeof(CHECKPOINT));
+    checkpoint.magic = CHECKPOINT_MAGIC;
+    checkpoint.op = op;
+    if(undoLog)
+        checkpoint.flags |= CHECKPOINT_FLAG_UNDO;
+    if(dlcDedupe)
+        checkpoint.flags |= CHECKPOINT_FLAG_DLCDEDUPE;
+    if(selectBest)
+        checkpoint.flags |= CHECKPOINT_FLAG_SELECTBEST;
+
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+    FSAMakeDir(fsaClient, path, 0x660);
+}
 
-            OSBlockMove(inSD, entry.name, 5, false);
-            ret = FSAMakeDir(fsaClient, sdPath, 0x660);
-            if(ret != FS_ERROR_OK)
-            {
-                WHBLogPrintf("Error creating %s", sdPath);
-                WHBLogPrint(FSAGetStatusStr(ret));
-                error = true;
-                break;
-            }
+static bool isBucketDone(uint16_t bucket)
+{
+    if(!resuming)
+        return false;
 
-            strcat(inSentence, "/");
-            fileName = inSentence + strlen(inSentence);
-            // Loop through all the subfolders
-            while(!error && FSAReadDir(fsaClient, dir2, &entry) == FS_ERROR_OK)
-            {
-                if(entry.name[0] == '.' || (entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 12)
-                    continue;
+    for(uint16_t i = 0; i < checkpoint.bucketCount; ++i)
+        if(checkpoint.buckets[i] == bucket)
+            return true;
 
-                strcpy(fileName, entry.name);
-                ret = readFile(path, &file, entry.info.size);
-                if(ret == FS_ERROR_OK)
-                {
-                    *inSD2 = '/';
-                    strcpy(inSD2 + 1, fileName);
-                    ret = FSAOpenFileEx(fsaClient, sdPath, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &fileHandle);
-                    if(ret == FS_ERROR_OK)
-                    {
-                        ret = FSAWriteFile(fsaClient, file, entry.info.size, 1, fileHandle, 0);
-                        if(ret != 1)
-                        {
-                            WHBLogPrintf("Error writing %s", sdPath);
-                            WHBLogPrint(FSAGetStatusStr(ret));
-                            error = true;
-                        }
-                        ret = FSACloseFile(fsaClient, fileHandle);
-                        if(ret != FS_ERROR_OK)
-                        {
-                            WHBLogPrintf("Error closing %s", sdPath);
-                            WHBLogPrint(FSAGetStatusStr(ret));
-                            error = true;
-                        }
+    return false;
+}
 
-                        ++arg0;
-                    }
-                    else
-                    {
-                        WHBLogPrintf("Error creating %s", sdPath);
-                        WHBLogPrint(FSAGetStatusStr(ret));
-                        error = true;
-                    }
-                }
-                else
-                {
-                    WHBLogPrintf("Error reading %s", path);
-                    WHBLogPrint(FSAGetStatusStr(ret));
-                    error = true;
-                }
+// files and read are the counters as they were when the bucket got done
+static void completeBucket(uint16_t bucket, size_t files, uint64_t read)
+{
+    // Buckets we can't remember simply get done again on resume
+    if(checkpoint.bucketCount < MAX_CHECKPOINT_BUCKETS)
+        checkpoint.buckets[checkpoint.bucketCount++] = bucket;
+
+    checkpoint.files = files;
+    checkpoint.dlcDuplicates = dlcDuplicates;
+    checkpoint.bytesRead = read;
+    writeCheckpoint();
+}
+
+static bool procLoop()
+{
+    // Long runs poll this too, so remember once we're told to exit
+    if(exiting)
+        return false;
+
+    switch(ProcUIProcessMessages(true))
+    {
+        case PROCUI_STATUS_EXITING:
+            exiting = true;
+            return false;
+        case PROCUI_STATUS_RELEASE_FOREGROUND:
+            ProcUIDrawDoneRelease();
+        default:
+            return true;
+    }
+}
+
+// Gets called between buckets, so HOME can end a checkpointed run. The checkpoint stays for resuming.
+static void checkInterrupted()
+{
+    if(!procLoop())
+    {
+        WHBLogPrint("Interrupted, the run can be resumed later.");
+        error = true;
+    }
+}
+
+static void removeCheckpoint()
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = CHECKPOINT_PATH;
+    FSError ret = FSARemove(fsaClient, path);
+    if(ret != FS_ERROR_OK && ret != FS_ERROR_NOT_FOUND)
+    {
+        WHBLogPrintf("Error removing %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+    }
+}
+
+// Loads the checkpoint of an interrupted run, restoring the options it ran with until restoreUserFlags(). Returns false if there's nothing to resume.
+static bool loadCheckpoint()
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = CHECKPOINT_PATH;
+    FSStat stat;
+    if(FSAGetStat(fsaClient, path, &stat) != FS_ERROR_OK)
+        return false;
+
+    if(stat.size != sizeof(CHECKPOINT))
+    {
+        WHBLogPrintf("%s is corrupted!", path);
+        error = true;
+        return false;
+    }
+
+    void *file;
+    FSError ret = readFile(path, &file, stat.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return false;
+    }
+
+    OSBlockMove(&checkpoint, file, sizeof(CHECKPOINT), false);
+    MEMFreeToDefaultHeap(file);
+    if(checkpoint.magic != CHECKPOINT_MAGIC || checkpoint.op > CHECKPOINT_OP_CLEANUP ||
+       checkpoint.targetCount > MAX_BACKUP_TARGETS || checkpoint.bucketCount > MAX_CHECKPOINT_BUCKETS)
+    {
+        WHBLogPrintf("%s is corrupted!", path);
+        error = true;
+        return false;
+    }
+
+    if(!userFlagsSaved)
+    {
+        userFlags = (undoLog ? CHECKPOINT_FLAG_UNDO : 0) | (dlcDedupe ? CHECKPOINT_FLAG_DLCDEDUPE : 0) | (selectBest ? CHECKPOINT_FLAG_SELECTBEST : 0);
+        userFlagsSaved = true;
+    }
+
+    undoLog = checkpoint.flags & CHECKPOINT_FLAG_UNDO;
+    dlcDedupe = checkpoint.flags & CHECKPOINT_FLAG_DLCDEDUPE;
+    selectBest = checkpoint.flags & CHECKPOINT_FLAG_SELECTBEST;
+    resuming = true;
+    return true;
+}
+
+// Gives the options loadCheckpoint() replaced back once the resumed operation is done, so later operations run with the user's settings
+static void restoreUserFlags()
+{
+    if(!userFlagsSaved)
+        return;
+
+    undoLog = userFlags & CHECKPOINT_FLAG_UNDO;
+    dlcDedupe = userFlags & CHECKPOINT_FLAG_DLCDEDUPE;
+    selectBest = userFlags & CHECKPOINT_FLAG_SELECTBEST;
+    userFlagsSaved = false;
+}
+
+static void releaseBackupJob(BACKUP_JOB *job)
+{
+    if(__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    if(job->buffer != NULL)
+        MEMFreeToDefaultHeap(job->buffer);
+
+    MEMFreeToDefaultHeap(job);
+}
+
+// One of these runs per backup target, so a slow target doesn't hold back the others
+static int backupWriter(int argc, const char **argv)
+{
+    BACKUP_TARGET *target = (BACKUP_TARGET *)argv;
+    OSMessage msg;
+    BACKUP_JOB *job;
+    FSAFileHandle handle;
+    FSError ret;
+    OSTime start;
+    bool written;
+    while(true)
+    {
+        OSReceiveMessage(&target->queue, &msg, OS_MESSAGE_FLAGS_BLOCKING);
+        job = msg.message;
+        if(job == NULL)
+            break;
+
+        written = false;
+        // After an error we just drain the queue, the path of the failing file stays in target->path
+        if(target->result == FS_ERROR_OK)
+        {
+            start = OSGetSystemTime();
+            strcpy(target->path + target->pathLen, job->name);
+            if(job->type == BACKUP_JOB_DIR)
+            {
+                ret = FSAMakeDir(target->client, target->path, 0x660);
+                // A resumed slot might have the directory already
+                if(ret == FS_ERROR_ALREADY_EXISTS)
+                    ret = FS_ERROR_OK;
+            }
+            else
+            {
+                ret = FSAOpenFileEx(target->client, target->path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &handle);
+                if(ret == FS_ERROR_OK)
+                {
+                    ret = FSAWriteFile(target->client, job->buffer, job->size, 1, handle, 0);
+                    if(ret == 1)
+                    {
+                        ret = FSACloseFile(target->client, handle);
+                        if(ret == FS_ERROR_OK && job->type == BACKUP_JOB_TICKET)
+                            ++target->files;
+                    }
+                    else
+                    {
+                        FSACloseFile(target->client, handle);
+                        // A short write isn't an error code but the backup is incomplete all the same
+                        if(ret >= 0)
+                            ret = FS_ERROR_STORAGE_FULL;
+                    }
+                }
+            }
+
+            // The main thread peeks at this to skip failed targets
+            __atomic_store_n(&target->result, ret, __ATOMIC_RELEASE);
+            target->busy += OSGetSystemTime() - start;
+            written = ret == FS_ERROR_OK;
+        }
+
+        if(written)
+            __atomic_add_fetch(&job->written, 1, __ATOMIC_RELEASE);
+
+        __atomic_add_fetch(&job->finished, 1, __ATOMIC_RELEASE);
+        releaseBackupJob(job);
+        __atomic_add_fetch(&target->processed, 1, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+static bool startBackupWriter(BACKUP_TARGET *target)
+{
+    target->queued = target->processed = 0;
+    target->client = FSAAddClient(NULL);
+    if(!target->client)
+    {
+        WHBLogPrint("No FSA client!");
+        return false;
+    }
+
+    MochaUtilsStatus ret = Mocha_UnlockFSClientEx(target->client);
+    if(ret == MOCHA_RESULT_SUCCESS)
+    {
+        uint32_t depth = target->depth != 0 ? target->depth : BACKUP_QUEUE_SIZE;
+        target->stack = MEMAllocFromDefaultHeapEx(BACKUP_STACK_SIZE, 8);
+        target->messages = target->stack == NULL ? NULL : MEMAllocFromDefaultHeap(depth * sizeof(OSMessage));
+        if(target->messages != NULL)
+        {
+            OSInitMessageQueue(&target->queue, target->messages, depth);
+            if(OSCreateThread(&target->thread, backupWriter, 0, (char *)target, ((uint8_t *)target->stack) + BACKUP_STACK_SIZE, BACKUP_STACK_SIZE, OSGetThreadPriority(OSGetCurrentThread()), OS_THREAD_ATTRIB_AFFINITY_ANY))
+            {
+                OSResumeThread(&target->thread);
+                return true;
+            }
+
+            WHBLogPrint("Error creating thread!");
+            MEMFreeToDefaultHeap(target->messages);
+            MEMFreeToDefaultHeap(target->stack);
+        }
+        else
+        {
+            if(target->stack != NULL)
+                MEMFreeToDefaultHeap(target->stack);
+
+            WHBLogPrint("EOM!");
+        }
+    }
+    else
+        WHBLogPrintf("Error unlocking FSAClient: -0x%04X!", -ret);
+
+    FSADelClient(target->client);
+    return false;
+}
+
+// True once every running target is through the files queued till the walk left the bucket
+static bool isBucketWritten(const PENDING_BUCKET *pending)
+{
+    for(size_t i = 0; i < backupTargetCount; ++i)
+        if(backupTargets[i].running && __atomic_load_n(&backupTargets[i].processed, __ATOMIC_ACQUIRE) < pending->queued[i])
+            return false;
+
+    return true;
+}
+
+// Checkpoints the pending buckets all targets are done with, oldest first.
+// Blocks only while more than maxPending buckets are left, so a slow target holds back its own checkpoint but not the walk.
+static void completeBuckets(size_t maxPending)
+{
+    size_t done = 0;
+    while(done < pendingBucketCount)
+    {
+        if(!isBucketWritten(pendingBuckets + done))
+        {
+            if(pendingBucketCount - done <= maxPending)
+                break;
+
+            OSSleepTicks(OSMillisecondsToTicks(1));
+            continue;
+        }
+
+        completeBucket(pendingBuckets[done].bucket, pendingBuckets[done].files, pendingBuckets[done].bytesRead);
+        ++done;
+    }
+
+    pendingBucketCount -= done;
+    if(done != 0 && pendingBucketCount != 0)
+        OSBlockMove(pendingBuckets, pendingBuckets + done, pendingBucketCount * sizeof(PENDING_BUCKET), false);
+}
+
+static void stopBackupWriter(BACKUP_TARGET *target)
+{
+    OSMessage msg = { .message = NULL };
+    OSSendMessage(&target->queue, &msg, OS_MESSAGE_FLAGS_BLOCKING);
+    OSJoinThread(&target->thread, NULL);
+    MEMFreeToDefaultHeap(target->messages);
+    MEMFreeToDefaultHeap(target->stack);
+    FSADelClient(target->client);
+}
+
+// Hands a file (or directory) to all targets still working. Takes ownership of buffer.
+// With keep the caller holds a reference, too: buffer stays valid till it calls releaseBackupJob(*keep).
+// If this fails with keep the caller still owns buffer.
+static bool queueBackupJob(BACKUP_JOB_TYPE type, void *buffer, size_t size, const char *name, BACKUP_JOB **keep)
+{
+    // Targets might fail while we're sending, so decide who gets the job first
+    BACKUP_TARGET *live[MAX_BACKUP_TARGETS];
+    uint32_t refs = 0;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+        if(backupTargets[i].running && __atomic_load_n(&backupTargets[i].result, __ATOMIC_ACQUIRE) == FS_ERROR_OK)
+            live[refs++] = backupTargets + i;
+
+    BACKUP_JOB *job = refs == 0 ? NULL : MEMAllocFromDefaultHeap(sizeof(BACKUP_JOB));
+    if(job == NULL)
+    {
+        if(buffer != NULL && keep == NULL)
+            MEMFreeToDefaultHeap(buffer);
+
+        WHBLogPrint(refs == 0 ? "All backup targets failed!" : "EOM!");
+        return false;
+    }
+
+    job->type = type;
+    job->refs = keep == NULL ? refs : refs + 1;
+    job->targets = refs;
+    job->finished = job->written = 0;
+    job->buffer = buffer;
+    job->size = size;
+    strcpy(job->name, name);
+
+    // Every target with room gets the job before we block on a full queue, so the others keep writing meanwhile
+    OSMessage msg = { .message = job };
+    uint32_t full = 0;
+    for(uint32_t i = 0; i < refs; ++i)
+    {
+        ++live[i]->queued;
+        if(!OSSendMessage(&live[i]->queue, &msg, OS_MESSAGE_FLAGS_NONE))
+            live[full++] = live[i];
+    }
+
+    // A full queue means this target is the slowest one, count that for the report
+    for(uint32_t i = 0; i < full; ++i)
+    {
+        ++live[i]->stalls;
+        OSSendMessage(&live[i]->queue, &msg, OS_MESSAGE_FLAGS_BLOCKING);
+    }
+
+    if(keep != NULL)
+        *keep = job;
+
+    return true;
+}
+
+// Blocks till a target wrote the job (needs a reference from queueBackupJob()). Returns false if all of them failed.
+static bool waitBackupJob(BACKUP_JOB *job)
+{
+    while(__atomic_load_n(&job->written, __ATOMIC_ACQUIRE) == 0 && __atomic_load_n(&job->finished, __ATOMIC_ACQUIRE) != job->targets)
+        OSSleepTicks(OSMillisecondsToTicks(1));
+
+    return __atomic_load_n(&job->written, __ATOMIC_ACQUIRE) != 0;
+}
+
+static bool createBackupSlot(BACKUP_TARGET *target)
+{
+    char *inPath = target->path + strlen(target->path);
+    FSAMakeDir(fsaClient, target->path, 0x660);
+    FSADirectoryHandle dir;
+    FSError ret = FSAOpenDir(fsaClient, target->path, &dir);
+    if(ret != FS_ERROR_OK)
+    {
+        target->result = ret;
+        return false;
+    }
+
+    // Loop through all the folders to find a free slot
+    uint16_t slot = 0;
+    uint16_t current;
+    FSADirectoryEntry entry;
+    while(FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
+    {
+        if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
+            continue;
+
+        current = strtol(entry.name, NULL, 16);
+        if(++current > slot)
+            slot = current;
+    }
+
+    FSACloseDir(fsaClient, dir);
+    target->slot = slot;
+    sprintf(inPath, "/%04X", slot);
+    ret = FSAMakeDir(fsaClient, target->path, 0x660);
+    if(ret != FS_ERROR_OK)
+    {
+        target->result = ret;
+        return false;
+    }
+
+    strcat(inPath, "/");
+    target->pathLen = strlen(target->path);
+    return true;
+}
+
+// Picks up the slot an interrupted backup was writing to
+static bool openBackupSlot(BACKUP_TARGET *target, uint16_t slot)
+{
+    if(slot == CHECKPOINT_NO_SLOT)
+    {
+        target->result = FS_ERROR_NOT_FOUND;
+        return false;
+    }
+
+    target->slot = slot;
+    sprintf(target->path + target->baseLen, "/%04X", slot);
+    FSError ret = FSAMakeDir(fsaClient, target->path, 0x660);
+    if(ret != FS_ERROR_OK && ret != FS_ERROR_ALREADY_EXISTS)
+    {
+        target->result = ret;
+        return false;
+    }
+
+    strcat(target->path, "/");
+    target->pathLen = strlen(target->path);
+    return true;
+}
+
+// The writer threads own the stats of their targets, so this only reports targets that got stopped already
+static void printBackupResults()
+{
+    BACKUP_TARGET *target;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+    {
+        target = backupTargets + i;
+        if(target->running)
+            continue;
+
+        if(target->result == FS_ERROR_OK)
+            WHBLogPrintf("%.*s: %u files, %u ms busy, %u stalls", (int)target->pathLen - 1, target->path, target->files, (uint32_t)OSTicksToMilliseconds(target->busy), target->stalls);
+        else
+            WHBLogPrintf("%s: %s", target->path, FSAGetStatusStr(target->result));
+    }
+}
+
+// The fused cleanup keeps going as long as one target works, so tell the user which backups miss the deleted tickets
+static void printFusedBackupWarning()
+{
+    uint32_t failed = 0;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+        if(!backupTargets[i].running && backupTargets[i].result != FS_ERROR_OK)
+            ++failed;
+
+    if(failed != 0)
+        WHBLogPrintf("Warning: %u of %u backup targets failed, the cleanup went ahead with the remaining ones only!", failed, (uint32_t)backupTargetCount);
+}
+
+static void addDefaultBackupTarget()
+{
+    // Without configured targets we backup to the SD card only
+    if(backupTargetCount == 0)
+    {
+        strcpy(backupTargets[0].path, SD_PATH);
+        backupTargets[0].baseLen = strlen(SD_PATH);
+        backupTargetCount = 1;
+    }
+}
+
+// The slots of a checkpoint only make sense for the targets it got written with
+static bool isSameBackupTargets()
+{
+    if(checkpoint.targetCount != backupTargetCount)
+        return false;
+
+    BACKUP_TARGET *target;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+    {
+        target = backupTargets + i;
+        if(strncmp(checkpoint.targets[i], target->path, target->baseLen) != 0 || checkpoint.targets[i][target->baseLen] != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+// Creates (or reopens when resuming) a slot per target and starts its writer. Returns false if no target works.
+static bool startBackup()
+{
+    addDefaultBackupTarget();
+    size_t working = 0;
+    BACKUP_TARGET *target;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+    {
+        target = backupTargets + i;
+        target->pathLen = target->baseLen;
+        target->path[target->pathLen] = '\0';
+        target->files = target->stalls = 0;
+        target->busy = 0;
+        target->result = FS_ERROR_OK;
+        target->running = resuming ? openBackupSlot(target, checkpoint.slots[i]) : createBackupSlot(target);
+        if(!resuming)
+            checkpoint.slots[i] = target->running ? target->slot : CHECKPOINT_NO_SLOT;
+        if(target->running)
+        {
+            target->running = startBackupWriter(target);
+            if(!target->running)
+                target->result = FS_ERROR_OUT_OF_RESOURCES;
+        }
+
+        if(target->running)
+            ++working;
+    }
+
+    if(working == 0)
+    {
+        printBackupResults();
+        error = true;
+        return false;
+    }
+
+    return true;
+}
+
+// Waits for the writers to finish everything queued
+static void finishBackup()
+{
+    size_t working = 0;
+    BACKUP_TARGET *target;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+    {
+        target = backupTargets + i;
+        if(target->running)
+        {
+            stopBackupWriter(target);
+            target->running = false;
+        }
+
+        if(target->result == FS_ERROR_OK)
+            ++working;
+    }
+
+    // Failing targets get reported, but as long as one backup got written that's no error
+    if(working == 0)
+    {
+        printBackupResults();
+        error = true;
+    }
+}
+
+// Walks the ticket directories below path (which has to end with a "/") and the ticket files inside of them.
+// The path gets changed while walking and is restored at the end.
+static void walkBucket(char *path, const BUCKET_WALKER *walker, void *ctx)
+{
+    char *inBase = path + strlen(path);
+    FSADirectoryHandle dir;
+    FSError ret = FSAOpenDir(fsaClient, path, &dir);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error opening %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    FSADirectoryEntry entry;
+    FSADirectoryHandle dir2;
+    char *fileName;
+    uint16_t bucket;
+    // Loop through all the folder inside of the ticket bucket
+    while(!error && FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
+    {
+        if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
+            continue;
+
+        bucket = (uint16_t)strtol(entry.name, NULL, 16);
+        strcpy(inBase, entry.name);
+        if(walker->enterDir != NULL && !walker->enterDir(ctx, path, bucket))
+            continue;
+        if(error)
+            break;
+
+        ret = FSAOpenDir(fsaClient, path, &dir2);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error opening %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+            break;
+        }
+
+        strcat(inBase, "/");
+        fileName = inBase + strlen(inBase);
+        // Loop through all the subfolders
+        while(!error && FSAReadDir(fsaClient, dir2, &entry) == FS_ERROR_OK)
+        {
+            if(entry.name[0] == '.' || (entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 12)
+                continue;
+
+            strcpy(fileName, entry.name);
+            walker->file(ctx, path, &entry);
+        }
+
+        FSACloseDir(fsaClient, dir2);
+        if(!error && walker->leaveDir != NULL)
+            walker->leaveDir(ctx, bucket);
+    }
+
+    FSACloseDir(fsaClient, dir);
+    *inBase = '\0';
+}
+
+// Reads the fixed size header of every ticket inside of a file, which is all that's needed to find the next one
+static void walkTicketHeaders(const char *path, size_t size, void (*callback)(void *ctx, const TICKET *ticket, size_t offset), void *ctx)
+{
+    FSAFileHandle handle;
+    FSError ret = FSAOpenFileEx(fsaClient, path, "r", 0x000, 0, 0, &handle);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error opening %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    uint8_t header[FS_ALIGN(sizeof(TICKET))] __attribute__((__aligned__(0x40)));
+    TICKET *ticket = (TICKET *)header;
+    size_t offset = 0;
+    while(!error && offset < size)
+    {
+        if(size - offset < sizeof(TICKET))
+        {
+            WHBLogPrintf("Filesize missmatch at %s!", path);
+            error = true;
+            break;
+        }
+
+        ret = FSAReadFileWithPos(fsaClient, header, sizeof(TICKET), 1, offset, handle, 0);
+        if(ret != 1)
+        {
+            WHBLogPrintf("Error reading %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+            break;
+        }
+
+        bytesRead += sizeof(TICKET);
+        callback(ctx, ticket, offset);
+
+        offset += sizeof(TICKET);
+        if(ticket->total_hdr_size > 0x14)
+            offset += ticket->total_hdr_size - 0x14;
+        if(offset > size)
+        {
+            WHBLogPrintf("Filesize missmatch at %s!", path);
+            error = true;
+        }
+    }
+
+    FSACloseFile(fsaClient, handle);
+}
+
+static bool enterBackupDir(void *ctx, char *path, uint16_t bucket)
+{
+    if(isBucketDone(bucket))
+        return false;
+
+    if(!queueBackupJob(BACKUP_JOB_DIR, NULL, 0, path + strlen(TICKET_BUCKET), NULL))
+        error = true;
+
+    return true;
+}
+
+// Every file gets read once and written to all targets from the same buffer
+static void backupTicketFile(void *ctx, char *path, const FSADirectoryEntry *entry)
+{
+    void *file;
+    FSError ret = readFile(path, &file, entry->info.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    if(queueBackupJob(BACKUP_JOB_TICKET, file, entry->info.size, path + strlen(TICKET_BUCKET), NULL))
+        ++arg0;
+    else
+        error = true;
+}
+
+// Only files that made it to the targets count as done, so the bucket waits till every target is through it
+static void leaveBackupDir(void *ctx, uint16_t bucket)
+{
+    if(pendingBucketCount == MAX_PENDING_BUCKETS)
+        completeBuckets(MAX_PENDING_BUCKETS - 1);
+
+    PENDING_BUCKET *pending = pendingBuckets + pendingBucketCount++;
+    pending->bucket = bucket;
+    pending->files = arg0;
+    pending->bytesRead = bytesRead;
+    for(size_t i = 0; i < backupTargetCount; ++i)
+        pending->queued[i] = backupTargets[i].queued;
+
+    completeBuckets(MAX_PENDING_BUCKETS);
+    checkInterrupted();
+}
+
+static void backupTickets()
+{
+    addDefaultBackupTarget();
+    if(resuming && !isSameBackupTargets())
+    {
+        WHBLogPrint("The backup targets changed, can't resume!");
+        resuming = false;
+        error = true;
+        return;
+    }
+
+    if(!resuming)
+    {
+        beginCheckpoint(CHECKPOINT_OP_BACKUP);
+        checkpoint.targetCount = backupTargetCount;
+        for(size_t i = 0; i < backupTargetCount; ++i)
+            strncpy(checkpoint.targets[i], backupTargets[i].path, backupTargets[i].baseLen);
+    }
+
+    pendingBucketCount = 0;
+
+    arg0 = resuming ? checkpoint.files : 0;
+    if(!startBackup())
+    {
+        resuming = false;
+        return;
+    }
+
+    // Without a checkpoint on the SD card there's no resuming
+    if(!resuming)
+        writeCheckpoint();
+
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
+    const BUCKET_WALKER walker = { .enterDir = enterBackupDir, .file = backupTicketFile, .leaveDir = leaveBackupDir };
+    walkBucket(path, &walker, NULL);
+
+    if(!error)
+    {
+        strcpy(path, TICKET_LIST_PATH);
+        FSStat stat;
+        void *file;
+        FSError ret = FSAGetStat(fsaClient, path, &stat);
+        if(ret == FS_ERROR_OK)
+            ret = readFile(path, &file, stat.size);
+        if(ret == FS_ERROR_OK)
+        {
+            if(!queueBackupJob(BACKUP_JOB_FILE, file, stat.size, "title.list", NULL))
+                error = true;
+        }
+        else
+        {
+            WHBLogPrintf("Error reading %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+
+    // The writers are stopped, so whatever is pending got written (or failed)
+    finishBackup();
+    completeBuckets(0);
+    resuming = false;
+    if(!error)
+        removeCheckpoint();
+}
+
+static void cleanTitleList(bool dryRun, bool logUndo)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_LIST_PATH;
+    FSStat stat;
+    FSError ret = FSAGetStat(fsaClient, path, &stat);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error stating %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    uint64_t *file;
+    ret = readFile(path, (void **)&file, stat.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    BACKUP_JOB *backupJob = NULL;
+    if(fusedBackup && !queueBackupJob(BACKUP_JOB_FILE, file, stat.size, "title.list", &backupJob))
+    {
+        MEMFreeToDefaultHeap(file);
+        error = true;
+        return;
+    }
+
+    // The plan needs all the TIDs to drop, worst case that's all of them
+    uint64_t *removed = NULL;
+    uint64_t hash = 0;
+    if(planning)
+    {
+        hash = hash64((uint8_t *)file, stat.size);
+        removed = MEMAllocFromDefaultHeap(stat.size + sizeof(uint64_t));
+        if(removed == NULL)
+        {
+            if(backupJob != NULL)
+                releaseBackupJob(backupJob);
+            else
+                MEMFreeToDefaultHeap(file);
+            WHBLogPrint("EOM!");
+            error = true;
+            return;
+        }
+    }
+
+    TITLE_LIST_ENTRY *titleList = NULL;
+    TITLE_LIST_ENTRY *cur = NULL;
+    TITLE_LIST_ENTRY *last = NULL;
+    arg1 = 0;
+    MCPTitleListType titleEntry __attribute__((__aligned__(0x40)));
+    for(size_t i = 0; i < stat.size / sizeof(uint64_t); ++i)
+    {
+        if(isSystemTitle(file[i]) || MCP_GetTitleInfo(mcpHandle, file[i], &titleEntry) == 0)
+        {
+            cur = MEMAllocFromDefaultHeap(sizeof(TITLE_LIST_ENTRY));
+            if(cur == NULL)
+            {
+                WHBLogPrint("EOM!");
+                error = true;
+                break;
+            }
+
+            cur->tid = file[i];
+            cur->next = NULL;
+
+            if(last == NULL)
+                titleList = cur;
+            else
+            {
+                last->next = cur;
+                last = cur;
+            }
+
+            last = cur;
+        }
+        else
+        {
+            if(removed != NULL)
+                removed[arg1] = file[i];
+
+            ++arg1;
+            if(logUndo && !dryRun)
+            {
+                writeUndoRecord(UNDO_RECORD_TITLE, NULL, (uint8_t *)(file + i), sizeof(uint64_t));
+                if(error)
+                    break;
+            }
+        }
+    }
+
+    if(backupJob != NULL)
+    {
+        // Same as for the ticket files: title.list has to be backed up before it's rewritten
+        if(!error && arg1 != 0 && !dryRun && !waitBackupJob(backupJob))
+        {
+            WHBLogPrintf("Backup of %s failed, stopping!", path);
+            error = true;
+        }
+
+        releaseBackupJob(backupJob);
+    }
+    else
+        MEMFreeToDefaultHeap(file);
+
+    if(removed != NULL)
+    {
+        if(!error && arg1 != 0)
+        {
+            PLAN_RECORD record = {
+                .hash = hash,
+                .type = PLAN_RECORD_TITLE_LIST,
+                .size = stat.size,
+                .keptCount = 0,
+                .removedCount = arg1,
+                .uninstalledCount = 0,
+                .name = "",
+            };
+            writePlan(&record, sizeof(PLAN_RECORD));
+            writePlan(removed, arg1 * sizeof(uint64_t));
+        }
+
+        MEMFreeToDefaultHeap(removed);
+    }
+
+    if(logUndo && !dryRun && !error && arg1 != 0)
+        flushUndoLog();
+
+    if(arg1 != 0 && !dryRun && !error)
+    {
+        ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+        if(ret == FS_ERROR_OK)
+        {
+            for(TITLE_LIST_ENTRY *cur = titleList; cur != NULL; cur = cur->next)
+            {
+                ret = writeTicket(&writer, (uint8_t *)&(cur->tid), sizeof(uint64_t));
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                    break;
+                }
+            }
+
+            ret = closeTicket(&writer);
+            if(ret != FS_ERROR_OK)
+            {
+                WHBLogPrintf("Error closing %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+            }
+        }
+        else
+        {
+            WHBLogPrintf("Error opening %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+
+    for(; titleList != NULL; titleList = titleList->next)
+        MEMFreeToDefaultHeap(titleList);
+}
+
+// Returns true if the very same ticket got seen before, remembers it otherwise
+static bool isDuplicateDLC(MAP *dlcTickets, const uint8_t *data, size_t size)
+{
+    uint64_t hash = hash64(data, size);
+    DLC_TICKET *first = getFromMap(dlcTickets, hash);
+    for(DLC_TICKET *cur = first; cur != NULL; cur = cur->next)
+        if(cur->size == size && memcmp(cur->data, data, size) == 0)
+            return true;
+
+    DLC_TICKET *copy = MEMAllocFromDefaultHeap(sizeof(DLC_TICKET) + size);
+    if(copy == NULL)
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+        return false;
+    }
+
+    copy->next = first;
+    copy->size = size;
+    OSBlockMove(copy->data, data, size, false);
+    if(!addToMap(dlcTickets, hash, copy))
+    {
+        MEMFreeToDefaultHeap(copy);
+        WHBLogPrint("EOM!");
+        error = true;
+    }
+
+    return false;
+}
+
+static void destroyDLCTickets(MAP *dlcTickets)
+{
+    DLC_TICKET *cur;
+    DLC_TICKET *next;
+    forEachMapEntry(dlcTickets, cur)
+    {
+        for(; cur != NULL; cur = next)
+        {
+            next = cur->next;
+            MEMFreeToDefaultHeap(cur);
+        }
+    }
+
+    destroyMap(dlcTickets, false);
+}
+
+// Deletes a ticket file or recreates it with the kept tickets only. The removed ones get logged for undo first.
+static void replaceTicketFile(char *path, const uint8_t *file, LIST *ticketList, LIST *removedList, bool logUndo)
+{
+    TICKET_SECTION *sec;
+    FSError ret;
+    if(!error && logUndo)
+    {
+        forEachListEntry(removedList, sec)
+        {
+            writeUndoRecord(UNDO_RECORD_TICKET, path, file + sec->offset, sec->size);
+            if(error)
+                break;
+        }
+
+        if(!error)
+            flushUndoLog();
+    }
+
+    if(!error && getListSize(ticketList) == 0)
+    {
+        ret = FSARemove(fsaClient, path);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error removing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+    else if(!error)
+    {
+        ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+        if(ret == FS_ERROR_OK)
+        {
+            forEachListEntry(ticketList, sec)
+            {
+                ret = writeTicket(&writer, file + sec->offset, sec->size);
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                }
+            }
+
+            if(!error)
+            {
+                ret = closeTicket(&writer);
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                }
+            }
+        }
+        else
+        {
+            WHBLogPrintf("Error opening %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+}
+
+// Bucket and file names are hex numbers, together they make a unique key for a ticket file
+// Values of the title states map, so every TID has to be looked up once only
+static const bool titleInstalled = true;
+static const bool titleUninstalled = false;
+
+static bool isTitleInstalled(MAP *titleStates, uint64_t tid)
+{
+    if(titleStates != NULL)
+    {
+        const bool *installed = getFromMap(titleStates, tid);
+        if(installed != NULL)
+            return *installed;
+    }
+
+    MCPTitleListType titleEntry __attribute__((__aligned__(0x40)));
+    return MCP_GetTitleInfo(mcpHandle, tid, &titleEntry) == 0;
+}
+
+// Finished buckets are clean already, so everything in them is installed. Their tickets still take part
+// as the winners from before the interruption, else a second ticket of their TIDs would survive.
+static bool enterSelectDir(void *ctx, char *path, uint16_t bucket)
+{
+    SELECT_WALK *walk = ctx;
+    walk->bucket = bucket;
+    walk->done = isBucketDone(bucket);
+    return true;
+}
+
+static void selectTicket(void *ctx, const TICKET *ticket, size_t offset)
+{
+    SELECT_WALK *walk = ctx;
+    const bool *installed = &titleInstalled;
+    if(!walk->done)
+    {
+        installed = getFromMap(walk->titleStates, ticket->tid);
+        if(installed == NULL)
+        {
+            installed = isTitleInstalled(NULL, ticket->tid) ? &titleInstalled : &titleUninstalled;
+            if(!addToMap(walk->titleStates, ticket->tid, (void *)installed))
+            {
+                WHBLogPrint("EOM!");
+                error = true;
+                return;
+            }
+        }
+    }
+
+    if(!*installed)
+    {
+        walk->state->uninstalled = true;
+        return;
+    }
+
+    if(isDLC(ticket->tid))
+        return;
+
+    if(walk->state != NULL)
+        ++walk->state->candidates;
+
+    BEST_TICKET *best = getFromMap(walk->bestTickets, ticket->tid);
+    bool first = best == NULL;
+    if(first)
+    {
+        best = MEMAllocFromDefaultHeap(sizeof(BEST_TICKET));
+        if(best == NULL || !addToMap(walk->bestTickets, ticket->tid, best))
+        {
+            if(best != NULL)
+                MEMFreeToDefaultHeap(best);
+
+            WHBLogPrint("EOM!");
+            error = true;
+            return;
+        }
+    }
+
+    offerBestTicket(best, first, walk->bucket, walk->name, offset, ticket->ticket_id, ticket->title_version);
+}
+
+static void selectTicketFile(void *ctx, char *path, const FSADirectoryEntry *entry)
+{
+    SELECT_WALK *walk = ctx;
+    walk->fileKey = ticketFileKey(walk->bucket, entry->name);
+    walk->name = entry->name;
+    walk->state = NULL;
+    if(!walk->done)
+    {
+        walk->state = MEMAllocFromDefaultHeap(sizeof(TICKET_FILE_STATE));
+        if(walk->state == NULL || !addToMap(walk->fileStates, walk->fileKey, walk->state))
+        {
+            if(walk->state != NULL)
+                MEMFreeToDefaultHeap(walk->state);
+
+            WHBLogPrint("EOM!");
+            error = true;
+            return;
+        }
+
+        walk->state->candidates = walk->state->winners = 0;
+        walk->state->uninstalled = false;
+    }
+
+    // Only the headers are needed here, the tickets get copied in the second pass
+    walkTicketHeaders(path, entry->info.size, selectTicket, walk);
+}
+
+// First pass of select=best: Finds the best ticket (highest title version, then highest ticket ID) for every installed non-DLC TID
+static void selectBestTickets(MAP *bestTickets, MAP *fileStates, MAP *titleStates)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
+    SELECT_WALK walk = { .bestTickets = bestTickets, .fileStates = fileStates, .titleStates = titleStates };
+    const BUCKET_WALKER walker = { .enterDir = enterSelectDir, .file = selectTicketFile };
+    walkBucket(path, &walker, &walk);
+    if(error)
+        return;
+
+    // Files where every candidate won and nothing is uninstalled don't need to be touched again
+    BEST_TICKET *best;
+    TICKET_FILE_STATE *state;
+    forEachMapEntry(bestTickets, best)
+    {
+        state = getFromMap(fileStates, best->file);
+        if(state != NULL)
+            ++state->winners;
+    }
+}
+
+static bool enterCleanupDir(void *ctx, char *path, uint16_t bucket)
+{
+    CLEANUP_WALK *walk = ctx;
+    // Finished buckets only get scanned to learn about the tickets kept in them
+    walk->bucket = bucket;
+    walk->done = !walk->dryRun && isBucketDone(bucket);
+    // With select=best there's nothing to learn from them
+    if(walk->done && selectBest)
+        return false;
+
+    if(fusedBackup && !queueBackupJob(BACKUP_JOB_DIR, NULL, 0, path + strlen(TICKET_BUCKET), NULL))
+        error = true;
+
+    return true;
+}
+
+static void cleanTicketFile(void *ctx, char *path, const FSADirectoryEntry *entry)
+{
+    CLEANUP_WALK *walk = ctx;
+    char *inSentence = path + strlen(TICKET_BUCKET);
+    void *file;
+    FSAFileHandle sparseHandle;
+    uint8_t header[FS_ALIGN(sizeof(TICKET))] __attribute__((__aligned__(0x40)));
+    TICKET *ticket;
+    TICKET_SECTION *sec;
+    bool keep;
+    bool uninstalled;
+    bool modified;
+    uint64_t *tid;
+    size_t offset;
+    size_t size;
+    uint8_t *section;
+    TICKET_FILE_STATE *state;
+    BEST_TICKET *best;
+    BACKUP_JOB *backupJob;
+    FSError ret;
+
+    if(selectBest && !fusedBackup)
+    {
+        // Skip files the selection pass found nothing to do for. Files that appeared in between are left alone, too.
+        // The fused backup needs every file, so it has to go through the tickets of these files as well.
+        state = getFromMap(walk->fileStates, ticketFileKey(walk->bucket, entry->name));
+        if(state == NULL || (!dlcDedupe && !state->uninstalled && state->winners == state->candidates))
+            return;
+    }
+
+    file = NULL;
+    backupJob = NULL;
+    if(walk->sparse)
+        ret = FSAOpenFileEx(fsaClient, path, "r", 0x000, 0, 0, &sparseHandle);
+    else
+        ret = readFile(path, &file, entry->info.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    // The backup gets the file as read, before it's touched. We keep a reference to clean from the same buffer.
+    if(fusedBackup && !queueBackupJob(BACKUP_JOB_TICKET, file, entry->info.size, inSentence, &backupJob))
+        error = true;
+
+    offset = 0;
+    modified = false;
+    // Loop through all the tickets inside of a file
+    while(!error)
+    {
+        if(entry->info.size - offset < sizeof(TICKET))
+        {
+            WHBLogPrintf("Filesize missmatch at %s!", path);
+            error = true;
+            break;
+        }
+
+        if(walk->sparse)
+        {
+            // The fixed size header is all we need to classify the ticket and to find the next one
+            ret = FSAReadFileWithPos(fsaClient, header, sizeof(TICKET), 1, offset, sparseHandle, 0);
+            if(ret != 1)
+            {
+                WHBLogPrintf("Error reading %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+                break;
+            }
+
+            bytesRead += sizeof(TICKET);
+            ticket = (TICKET *)header;
+        }
+        else
+            ticket = (TICKET *)(((uint8_t *)file) + offset);
+
+        size = sizeof(TICKET);
+        if(ticket->total_hdr_size > 0x14)
+            size += ticket->total_hdr_size - 0x14;
+
+        // Finished buckets got cleaned before the interruption, everything in them stays. They only fill
+        // handledIds and dlcTickets for the buckets still to do.
+        keep = true;
+        // Check that title is installed (select=best knows already)
+        uninstalled = !walk->done && !isTitleInstalled(walk->titleStates, ticket->tid);
+        if(uninstalled)
+            keep = false;
+        // Check for duplicated tickets (ignoring DLC tickets)
+        else if(!isDLC(ticket->tid))
+        {
+            // select=best skips finished buckets altogether
+            if(selectBest)
+            {
+                best = getFromMap(walk->bestTickets, ticket->tid);
+                keep = isBestTicket(best, walk->bucket, entry->name, offset);
+            }
+            else if(!walk->done)
+            {
+                forEachListEntry(walk->handledIds, tid)
+                {
+                    if(ticket->tid == *tid)
+                    {
+                        keep = false;
+                        break;
+                    }
+                }
+            }
+        }
+        // DLC tickets sharing a TID are fine, byte identical copies are not
+        else if(dlcDedupe)
+        {
+            if(walk->sparse)
+            {
+                section = MEMAllocFromDefaultHeapEx(FS_ALIGN(size), 0x40);
+                if(section == NULL)
+                {
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+
+                ret = FSAReadFileWithPos(fsaClient, section, size, 1, offset, sparseHandle, 0);
+                if(ret != 1)
+                {
+                    MEMFreeToDefaultHeap(section);
+                    WHBLogPrintf("Error reading %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                    break;
+                }
+
+                bytesRead += size;
+            }
+            else
+                section = ((uint8_t *)file) + offset;
+
+            // This remembers the ticket, so it has to run for finished buckets, too
+            if(isDuplicateDLC(walk->dlcTickets, section, size) && !walk->done)
+            {
+                keep = false;
+                ++dlcDuplicates;
+            }
+
+            if(walk->sparse)
+                MEMFreeToDefaultHeap(section);
+            if(error)
+                break;
+        }
+
+        if(keep)
+        {
+            if(!isDLC(ticket->tid))
+            {
+                tid = MEMAllocFromDefaultHeap(sizeof(uint64_t));
+                if(!tid)
+                {
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+                if(!addToListEnd(walk->handledIds, tid))
+                {
+                    MEMFreeToDefaultHeap(tid);
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+
+                *tid = ticket->tid;
+            }
+
+            sec = MEMAllocFromDefaultHeap(sizeof(TICKET_SECTION));
+            if(!sec)
+            {
+                WHBLogPrint("EOM!");
+                error = true;
+                break;
+            }
+            if(!addToListEnd(walk->ticketList, sec))
+            {
+                MEMFreeToDefaultHeap(sec);
+                WHBLogPrint("EOM!");
+                error = true;
+                break;
+            }
+
+            sec->offset = offset;
+            sec->size = size;
+        }
+        else
+        {
+            ++arg0;
+            modified = true;
+
+            // Remember what gets removed for the undo log and the plan
+            if(walk->logUndo || planning)
+            {
+                sec = MEMAllocFromDefaultHeap(sizeof(TICKET_SECTION));
+                if(!sec)
+                {
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+                if(!addToListEnd(walk->removedList, sec))
+                {
+                    MEMFreeToDefaultHeap(sec);
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+
+                sec->offset = offset;
+                sec->size = size;
+            }
+
+            // apply checks these are still not installed
+            if(planning && uninstalled)
+            {
+                tid = MEMAllocFromDefaultHeap(sizeof(uint64_t));
+                if(!tid)
+                {
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+                if(!addToListEnd(walk->uninstalledList, tid))
+                {
+                    MEMFreeToDefaultHeap(tid);
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+
+                *tid = ticket->tid;
+            }
+        }
+
+        offset += size;
+        if(offset == entry->info.size)
+            break;
+        if(offset > entry->info.size)
+        {
+            WHBLogPrintf("Filesize missmatch at %s!", path);
+            error = true;
+            break;
+        }
+    }
+
+    if(walk->sparse)
+        FSACloseFile(fsaClient, sparseHandle);
+
+    if(!error && modified && planning)
+    {
+        // The plan stores the hash of the whole file
+        if(file == NULL)
+        {
+            ret = readFile(path, &file, entry->info.size);
+            if(ret != FS_ERROR_OK)
+            {
+                WHBLogPrintf("Error reading %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+                file = NULL;
+            }
+        }
+
+        if(!error)
+            writePlanFile(inSentence, file, entry->info.size, walk->ticketList, walk->removedList, walk->uninstalledList);
+    }
+
+    // In case there was a matching ticket inside of the file either delete or recreate it with the remembered tickets only (a dry run just counts)
+    if(!error && modified && !walk->dryRun)
+    {
+        // The sparse scan only read the headers but now we need the whole file
+        if(file == NULL && (walk->logUndo || getListSize(walk->ticketList) != 0))
+        {
+            ret = readFile(path, &file, entry->info.size);
+            if(ret != FS_ERROR_OK)
+            {
+                WHBLogPrintf("Error reading %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+                file = NULL;
+            }
+        }
+
+        // Nothing gets deleted before it's safe on at least one backup target
+        if(!error && backupJob != NULL && !waitBackupJob(backupJob))
+        {
+            WHBLogPrintf("Backup of %s failed, stopping!", path);
+            error = true;
+        }
+
+        if(!error)
+            replaceTicketFile(path, file, walk->ticketList, walk->removedList, walk->logUndo);
+    }
+
+    clearList(walk->ticketList, true);
+    clearList(walk->removedList, true);
+    clearList(walk->uninstalledList, true);
+    if(backupJob != NULL)
+        releaseBackupJob(backupJob);
+    else if(file != NULL)
+        MEMFreeToDefaultHeap(file);
+}
+
+static void leaveCleanupDir(void *ctx, uint16_t bucket)
+{
+    CLEANUP_WALK *walk = ctx;
+    if(!walk->dryRun && !walk->done && !fusedBackup)
+    {
+        completeBucket(bucket, arg0, bytesRead);
+        checkInterrupted();
+    }
+}
+
+static void deleteTickets(bool dryRun)
+{
+    bool logUndo = undoLog && !dryRun;
+    // The backup needs the whole files anyway
+    bool sparse = sparseScan && !fusedBackup;
+    if(logUndo && !openUndoLog())
+        return;
+
+    LIST *handledIds = createList();
+    if(handledIds == NULL)
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+        closeUndoLog();
+        return;
+    }
+
+    LIST *ticketList = createList();
+    LIST *removedList = createList();
+    LIST *uninstalledList = createList();
+    MAP *dlcTickets = dlcDedupe ? createMap() : NULL;
+    MAP *bestTickets = selectBest ? createMap() : NULL;
+    MAP *fileStates = selectBest ? createMap() : NULL;
+    MAP *titleStates = selectBest ? createMap() : NULL;
+    if(ticketList != NULL && removedList != NULL && uninstalledList != NULL && (!dlcDedupe || dlcTickets != NULL) && (!selectBest || (bestTickets != NULL && fileStates != NULL && titleStates != NULL)))
+    {
+        if(resuming && !dryRun)
+        {
+            arg0 = checkpoint.files;
+            dlcDuplicates = checkpoint.dlcDuplicates;
+            bytesRead = checkpoint.bytesRead;
+        }
+        else
+        {
+            arg0 = 0;
+            dlcDuplicates = 0;
+            bytesRead = 0;
+            if(!dryRun && !fusedBackup)
+            {
+                beginCheckpoint(CHECKPOINT_OP_CLEANUP);
+                writeCheckpoint();
+            }
+        }
+
+        if(selectBest && !error)
+            selectBestTickets(bestTickets, fileStates, titleStates);
+
+        if(!error)
+        {
+            char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
+            CLEANUP_WALK walk = {
+                .dryRun = dryRun,
+                .logUndo = logUndo,
+                .sparse = sparse,
+                .handledIds = handledIds,
+                .ticketList = ticketList,
+                .removedList = removedList,
+                .uninstalledList = uninstalledList,
+                .dlcTickets = dlcTickets,
+                .bestTickets = bestTickets,
+                .fileStates = fileStates,
+                .titleStates = titleStates,
+            };
+            const BUCKET_WALKER walker = { .enterDir = enterCleanupDir, .file = cleanTicketFile, .leaveDir = leaveCleanupDir };
+            walkBucket(path, &walker, &walk);
+        }
+    }
+    else
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+    }
+
+    if(ticketList != NULL)
+        destroyList(ticketList, true);
+    if(removedList != NULL)
+        destroyList(removedList, true);
+    if(uninstalledList != NULL)
+        destroyList(uninstalledList, true);
+    if(dlcTickets != NULL)
+        destroyDLCTickets(dlcTickets);
+    if(bestTickets != NULL)
+        destroyMap(bestTickets, true);
+    if(fileStates != NULL)
+        destroyMap(fileStates, true);
+    if(titleStates != NULL)
+        destroyMap(titleStates, false);
+
+    destroyList(handledIds, true);
+    if(!error)
+        cleanTitleList(dryRun, logUndo);
+    if(logUndo)
+        closeUndoLog();
+
+    if(!dryRun && !fusedBackup)
+    {
+        resuming = false;
+        if(!error)
+            removeCheckpoint();
+    }
+}
+
+// Backup and cleanup in one walk over the bucket: every file gets read once, queued for the backup targets and
+// cleaned from the same buffer. There's no checkpoint for this, an interrupted run leaves an incomplete slot behind.
+// With select=best the ticket headers get read in a pass before, as the winners have to be known before the first deletion.
+static void backupAndClean()
+{
+    if(!startBackup())
+        return;
+
+    fusedBackup = true;
+    deleteTickets(false);
+    fusedBackup = false;
+    finishBackup();
+}
+
+// Runs a dry cleanup and saves what it would do to PLAN_PATH
+static void planCleanup()
+{
+    if(!openPlan())
+        return;
+
+    deleteTickets(true);
+    closePlan();
+    if(error)
+    {
+        // Half a plan is worse than none
+        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = PLAN_PATH;
+        FSARemove(fsaClient, path);
+    }
+}
+
+// Drops the planned TIDs from title.list
+// file is title.list as validatePlan() read it, the kept entries get moved to its start
+static void applyTitleList(const uint64_t *tids, size_t count, uint64_t *file, size_t size, bool logUndo)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_LIST_PATH;
+    FSError ret;
+
+    // Keep the entries in place, the file is tiny compared to the ticket bucket
+    size_t kept = 0;
+    size_t j;
+    for(size_t i = 0; i < size / sizeof(uint64_t); ++i)
+    {
+        for(j = 0; j < count; ++j)
+            if(file[i] == tids[j])
+                break;
+
+        if(j == count)
+            file[kept++] = file[i];
+        else
+        {
+            ++arg1;
+            if(logUndo)
+            {
+                writeUndoRecord(UNDO_RECORD_TITLE, NULL, (uint8_t *)(file + i), sizeof(uint64_t));
+                if(error)
+                    break;
+            }
+        }
+    }
+
+    if(logUndo && !error && arg1 != 0)
+        flushUndoLog();
+
+    if(!error && arg1 != 0)
+    {
+        ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+        if(ret == FS_ERROR_OK)
+        {
+            ret = writeTicket(&writer, (uint8_t *)file, kept * sizeof(uint64_t));
+            if(ret == FS_ERROR_OK)
+                ret = closeTicket(&writer);
+        }
+
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error writing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+}
+
+// Errors if the install state of a removed ticket differs from planning time
+static bool checkPlannedTitle(uint64_t tid, bool wasInstalled)
+{
+    if(isTitleInstalled(NULL, tid) == wasInstalled)
+        return true;
+
+    WHBLogPrintf("%016llX got %s since planning, plan again!", (unsigned long long)tid, wasInstalled ? "uninstalled" : "installed");
+    return false;
+}
+
+// Checks that none of the files a plan (checked by checkPlan()) touches changed since it got made. The removed
+// tickets have to have the same install state as when planning, so nothing installed in between gets lost.
+// The files executePlan() needs stay in files (one per record, NULL otherwise), so they don't get read twice.
+static bool validatePlan(const uint8_t *plan, size_t size, void **files, bool logUndo)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40)));
+    const PLAN_RECORD *record;
+    const TICKET_SECTION *removed;
+    const uint64_t *tids;
+    uint8_t *file;
+    FSStat stat;
+    FSError ret;
+    bool ok = true;
+    bool wasInstalled;
+    uint64_t tid;
+    size_t r = 0;
+    for(size_t i = sizeof(uint32_t); ok && i < size; i += planRecordDataSize(record), ++r)
+    {
+        record = (const PLAN_RECORD *)(plan + i);
+        i += sizeof(PLAN_RECORD);
+        if(record->type == PLAN_RECORD_FILE)
+        {
+            strcpy(path, TICKET_BUCKET);
+            strcat(path, record->name);
+        }
+        else
+            strcpy(path, TICKET_LIST_PATH);
+
+        ret = FSAGetStat(fsaClient, path, &stat);
+        if(ret != FS_ERROR_OK || stat.size != record->size)
+        {
+            WHBLogPrintf("%s changed, plan again!", path);
+            return false;
+        }
+
+        ret = readFile(path, (void **)&file, stat.size);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error reading %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            return false;
+        }
+
+        if(!isPlannedFile(record, file, stat.size))
+        {
+            WHBLogPrintf("%s changed, plan again!", path);
+            ok = false;
+        }
+        else if(record->type == PLAN_RECORD_FILE)
+        {
+            removed = (const TICKET_SECTION *)(plan + i) + record->keptCount;
+            tids = (const uint64_t *)(removed + record->removedCount);
+            for(size_t j = 0; ok && j < record->removedCount; ++j)
+            {
+                // Duplicates got removed while installed, the rest for not being installed
+                tid = ((TICKET *)(file + removed[j].offset))->tid;
+                wasInstalled = true;
+                for(size_t k = 0; wasInstalled && k < record->uninstalledCount; ++k)
+                    if(tids[k] == tid)
+                        wasInstalled = false;
+
+                ok = checkPlannedTitle(tid, wasInstalled);
+            }
+        }
+        else
+        {
+            tids = (const uint64_t *)(plan + i);
+            for(size_t j = 0; ok && j < record->removedCount; ++j)
+                ok = checkPlannedTitle(tids[j], false);
+        }
+
+        // Deletions without undo log don't need the data
+        if(record->type == PLAN_RECORD_TITLE_LIST || logUndo || record->keptCount != 0)
+            files[r] = file;
+        else
+            MEMFreeToDefaultHeap(file);
+    }
+
+    return ok;
+}
+
+// Files to delete go first, then the rewrites, then title.list. files are the buffers validatePlan() kept.
+static void executePlan(uint8_t *plan, size_t size, void **files, LIST *ticketList, LIST *removedList, bool logUndo)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
+    char *inSentence = path + strlen(TICKET_BUCKET);
+    PLAN_RECORD *record;
+    PLAN_RECORD *titleRecord = NULL;
+    uint64_t *titleList = NULL;
+    TICKET_SECTION *sections;
+    size_t count;
+    size_t r;
+    for(int pass = 0; pass < 2 && !error; ++pass)
+    {
+        r = 0;
+        for(size_t i = sizeof(uint32_t); !error && i < size; i += count, ++r)
+        {
+            record = (PLAN_RECORD *)(plan + i);
+            i += sizeof(PLAN_RECORD);
+            if(record->type == PLAN_RECORD_TITLE_LIST)
+            {
+                count = planRecordDataSize(record);
+                titleRecord = record;
+                titleList = files[r];
+                continue;
+            }
+
+            count = planRecordDataSize(record);
+            if((record->keptCount == 0) != (pass == 0))
+                continue;
+
+            // The lists just point into the plan
+            sections = (TICKET_SECTION *)(plan + i);
+            for(size_t j = 0; j < record->keptCount + record->removedCount; ++j)
+            {
+                if(!addToListEnd(j < record->keptCount ? ticketList : removedList, sections + j))
+                {
+                    WHBLogPrint("EOM!");
+                    error = true;
+                    break;
+                }
+            }
+
+            strcpy(inSentence, record->name);
+            if(!error)
+            {
+                replaceTicketFile(path, files[r], ticketList, removedList, logUndo);
+                arg0 += record->removedCount;
+            }
+
+            clearList(ticketList, false);
+            clearList(removedList, false);
+        }
+    }
+
+    if(!error && titleRecord != NULL)
+        applyTitleList((uint64_t *)(titleRecord + 1), titleRecord->removedCount, titleList, titleRecord->size, logUndo);
+}
+
+// Executes PLAN_PATH without scanning the ticket bucket again. A plan can only be applied once.
+static void applyPlan()
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = PLAN_PATH;
+    FSStat stat;
+    arg0 = arg1 = 0;
+    FSError ret = FSAGetStat(fsaClient, path, &stat);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error stating %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    uint8_t *plan;
+    ret = readFile(path, (void **)&plan, stat.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    if(!checkPlan(plan, stat.size))
+    {
+        WHBLogPrintf("%s is corrupted!", path);
+        error = true;
+        MEMFreeToDefaultHeap(plan);
+        return;
+    }
+
+    size_t records = planRecordCount(plan, stat.size);
+    void **files = MEMAllocFromDefaultHeap(records * sizeof(void *) + 1); // An empty plan needs a valid pointer, too
+    LIST *ticketList = createList();
+    LIST *removedList = createList();
+    if(files != NULL && ticketList != NULL && removedList != NULL)
+    {
+        OSBlockSet(files, 0, records * sizeof(void *));
+        if(validatePlan(plan, stat.size, files, undoLog))
+        {
+            if(!undoLog || openUndoLog())
+            {
+                executePlan(plan, stat.size, files, ticketList, removedList, undoLog);
+                if(undoLog)
+                    closeUndoLog();
+            }
+
+            // A plan must not be applied twice
+            if(!error)
+            {
+                ret = FSARemove(fsaClient, path);
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error removing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                }
+            }
+        }
+        else
+            error = true;
+    }
+    else
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+    }
+
+    if(ticketList != NULL)
+        destroyList(ticketList, false);
+    if(removedList != NULL)
+        destroyList(removedList, false);
+    if(files != NULL)
+    {
+        for(size_t i = 0; i < records; ++i)
+            if(files[i] != NULL)
+                MEMFreeToDefaultHeap(files[i]);
+
+        MEMFreeToDefaultHeap(files);
+    }
+
+    MEMFreeToDefaultHeap(plan);
+}
+
+// Makes room for one more element
+static bool growArray(void **array, size_t count, size_t *capacity, size_t size)
+{
+    if(count < *capacity)
+        return true;
+
+    size_t newCapacity = *capacity == 0 ? 1024 : *capacity * 2;
+    void *newArray = MEMAllocFromDefaultHeap(newCapacity * size);
+    if(newArray == NULL)
+        return false;
+
+    if(*array != NULL)
+    {
+        OSBlockMove(newArray, *array, count * size, false);
+        MEMFreeToDefaultHeap(*array);
+    }
+
+    *array = newArray;
+    *capacity = newCapacity;
+    return true;
+}
+
+static bool addTid(uint64_t **tids, size_t *count, size_t *capacity, uint64_t tid)
+{
+    if(!growArray((void **)tids, *count, capacity, sizeof(uint64_t)))
+        return false;
+
+    (*tids)[(*count)++] = tid;
+    return true;
+}
+
+static void collectTicketTid(void *ctx, const TICKET *ticket, size_t offset)
+{
+    TID_ARRAY *array = ctx;
+    if(!addTid(&array->tids, &array->count, &array->capacity, ticket->tid))
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+    }
+}
+
+static void collectTicketFileTids(void *ctx, char *path, const FSADirectoryEntry *entry)
+{
+    walkTicketHeaders(path, entry->info.size, collectTicketTid, ctx);
+}
+
+// Header scan of the whole bucket, collecting the TID of every ticket
+static uint64_t *collectTicketTids(size_t *count)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
+    TID_ARRAY array = { .tids = NULL, .count = 0, .capacity = 0 };
+    const BUCKET_WALKER walker = { .file = collectTicketFileTids };
+    walkBucket(path, &walker, &array);
+
+    *count = array.count;
+    if(error && array.tids != NULL)
+    {
+        MEMFreeToDefaultHeap(array.tids);
+        array.tids = NULL;
+    }
+
+    return array.tids;
+}
+
+static uint64_t *collectInstalledTids(size_t *count)
+{
+    *count = 0;
+    int32_t titleCount = MCP_TitleCount(mcpHandle);
+    if(titleCount <= 0)
+    {
+        WHBLogPrint("Error counting titles!");
+        error = true;
+        return NULL;
+    }
+
+    MCPTitleListType *titles = MEMAllocFromDefaultHeapEx(FS_ALIGN(sizeof(MCPTitleListType) * titleCount), 0x40);
+    uint64_t *tids = MEMAllocFromDefaultHeap(sizeof(uint64_t) * titleCount);
+    if(titles == NULL || tids == NULL)
+    {
+        if(titles != NULL)
+            MEMFreeToDefaultHeap(titles);
+        if(tids != NULL)
+            MEMFreeToDefaultHeap(tids);
+
+        WHBLogPrint("EOM!");
+        error = true;
+        return NULL;
+    }
+
+    uint32_t listed;
+    MCPError ret = MCP_TitleList(mcpHandle, &listed, titles, sizeof(MCPTitleListType) * titleCount);
+    if(ret < 0)
+    {
+        MEMFreeToDefaultHeap(titles);
+        MEMFreeToDefaultHeap(tids);
+        WHBLogPrintf("Error listing titles: -0x%04X!", -ret);
+        error = true;
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < listed && i < (uint32_t)titleCount; ++i)
+        tids[(*count)++] = titles[i].titleId;
+
+    MEMFreeToDefaultHeap(titles);
+    return tids;
+}
+
+static void writeCheckLine(void *ctx, CHECK_KIND kind, uint64_t tid)
+{
+    static const char *const kindNames[CHECK_KINDS] = {
+        "listed_without_ticket",
+        "installed_not_listed",
+        "ticket_not_installed",
+    };
+
+    ++checkCounts[kind];
+    if(error)
+        return;
+
+    char line[64];
+    size_t len = sprintf(line, "%s %016llX%s\n", kindNames[kind], (unsigned long long)tid, isSystemTitle(tid) ? " system" : "");
+    FSError ret = writeTicket(&writer, (uint8_t *)line, len);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error writing %s", CHECK_PATH);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+    }
+}
+
+// Compares the tickets in the bucket, title.list and the installed titles. All three get sorted, so a single merge
+// finds every mismatch. The details go to CHECK_PATH.
+static void checkConsistency()
+{
+    for(size_t i = 0; i < CHECK_KINDS; ++i)
+        checkCounts[i] = 0;
+
+    checkWritten = false;
+    bytesRead = 0;
+    size_t ticketCount;
+    size_t listCount = 0;
+    size_t installedCount;
+    uint64_t *list = NULL;
+    uint64_t *installed = NULL;
+    uint64_t *tickets = collectTicketTids(&ticketCount);
+    if(!error)
+        installed = collectInstalledTids(&installedCount);
+    if(!error)
+    {
+        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_LIST_PATH;
+        FSStat stat;
+        FSError ret = FSAGetStat(fsaClient, path, &stat);
+        if(ret == FS_ERROR_OK)
+            ret = readFile(path, (void **)&list, stat.size);
+        if(ret == FS_ERROR_OK)
+            listCount = stat.size / sizeof(uint64_t);
+        else
+        {
+            WHBLogPrintf("Error reading %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+            list = NULL;
+        }
+    }
+
+    if(!error)
+    {
+        ticketCount = sortTids(tickets, ticketCount);
+        listCount = sortTids(list, listCount);
+        installedCount = sortTids(installed, installedCount);
+
+        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+        FSAMakeDir(fsaClient, path, 0x660);
+        strcpy(path, CHECK_PATH);
+        FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+        if(ret == FS_ERROR_OK)
+        {
+            writer.fill = 0;
+            joinTids(tickets, ticketCount, list, listCount, installed, installedCount, writeCheckLine, NULL);
+
+            // writeTicket() closes the file on errors
+            if(!error)
+            {
+                ret = closeTicket(&writer);
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                }
+                else
+                    checkWritten = true;
+            }
+        }
+        else
+        {
+            WHBLogPrintf("Error opening %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+
+    if(tickets != NULL)
+        MEMFreeToDefaultHeap(tickets);
+    if(list != NULL)
+        MEMFreeToDefaultHeap(list);
+    if(installed != NULL)
+        MEMFreeToDefaultHeap(installed);
+}
+
+static bool addIndexRecord(INDEX_RECORD **records, INDEX_HEADER *header, size_t *capacity, INDEX_RECORD_TYPE type, uint64_t tid, const uint8_t *data, uint32_t size, const char *name)
+{
+    if(!growArray((void **)records, header->count, capacity, sizeof(INDEX_RECORD)))
+    {
+        WHBLogPrint("EOM!");
+        error = true;
+        return false;
+    }
+
+    INDEX_RECORD *record = *records + header->count++;
+    record->tid = tid;
+    record->hash = data == NULL ? 0 : hash64(data, size);
+    record->size = size;
+    record->type = type;
+    strcpy(record->name, name);
+    return true;
+}
+
+// A file rewritten with the same size still changes the stamp by its modification time. The sum doesn't depend
+// on the order the directories get read in.
+static void stampIndexFile(INDEX_HEADER *header, const char *name, const FSStat *stat)
+{
+    uint64_t info[2] = { stat->size, (uint64_t)stat->modified };
+    header->stamp += hash64((const uint8_t *)name, strlen(name)) ^ hash64((const uint8_t *)info, sizeof(info));
+}
+
+static void indexTicketFile(void *ctx, char *path, const FSADirectoryEntry *entry)
+{
+    INDEX_WALK *walk = ctx;
+    ++walk->header->files;
+    walk->header->bytes += entry->info.size;
+    stampIndexFile(walk->header, walk->inSlot, &entry->info);
+    if(walk->records == NULL)
+        return;
+
+    uint8_t *file;
+    FSError ret = readFile(path, (void **)&file, entry->info.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    TICKET *ticket;
+    size_t size;
+    for(size_t offset = 0; offset < entry->info.size; offset += size)
+    {
+        size = sizeof(TICKET);
+        ticket = (TICKET *)(file + offset);
+        if(entry->info.size - offset >= size && ticket->total_hdr_size > 0x14)
+            size += ticket->total_hdr_size - 0x14;
+
+        if(entry->info.size - offset < size)
+        {
+            WHBLogPrintf("Filesize missmatch at %s!", path);
+            error = true;
+            break;
+        }
+
+        if(!addIndexRecord(walk->records, walk->header, &walk->capacity, INDEX_RECORD_TICKET, ticket->tid, file + offset, size, walk->inSlot))
+            break;
+    }
+
+    MEMFreeToDefaultHeap(file);
+}
+
+// Walks a slot (path has to end with a "/"). Without records the files just get counted, else every ticket and
+// title.list entry ends up in the sorted records.
+static bool indexSlot(char *path, INDEX_HEADER *header, INDEX_RECORD **records)
+{
+    char *inSlot = path + strlen(path);
+    header->magic = INDEX_MAGIC;
+    header->files = header->count = 0;
+    header->bytes = header->stamp = 0;
+
+    INDEX_WALK walk = { .header = header, .records = records, .capacity = 0, .inSlot = inSlot };
+    const BUCKET_WALKER walker = { .file = indexTicketFile };
+    walkBucket(path, &walker, &walk);
+
+    // An interrupted backup might not have gotten to title.list
+    FSStat stat;
+    strcpy(inSlot, "title.list");
+    if(!error && FSAGetStat(fsaClient, path, &stat) == FS_ERROR_OK)
+    {
+        ++header->files;
+        header->bytes += stat.size;
+        stampIndexFile(header, inSlot, &stat);
+        if(records != NULL)
+        {
+            uint64_t *list;
+            FSError ret = readFile(path, (void **)&list, stat.size);
+            if(ret == FS_ERROR_OK)
+            {
+                for(size_t i = 0; i < stat.size / sizeof(uint64_t); ++i)
+                    if(!addIndexRecord(records, header, &walk.capacity, INDEX_RECORD_TITLE_LIST, list[i], NULL, sizeof(uint64_t), inSlot))
+                        break;
+
+                MEMFreeToDefaultHeap(list);
+            }
+            else
+            {
+                WHBLogPrintf("Error reading %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+            }
+        }
+    }
+
+    *inSlot = '\0';
+    if(error)
+    {
+        if(records != NULL && *records != NULL)
+        {
+            MEMFreeToDefaultHeap(*records);
+            *records = NULL;
+        }
+
+        return false;
+    }
+
+    if(records != NULL && header->count != 0)
+        qsort(*records, header->count, sizeof(INDEX_RECORD), compareIndexRecords);
+
+    return true;
+}
+
+// Returns the sorted index of a slot. The cached one gets used as long as the files of the slot didn't change,
+// else the index gets rebuilt and cached. Check error to see if a NULL return is an empty slot or a failure.
+static INDEX_RECORD *loadSlotIndex(uint16_t slot, size_t *count)
+{
+    *count = 0;
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+    char *inSlot = path + strlen(SD_PATH);
+    sprintf(inSlot, "/%04X/", slot);
+    inSlot += 6;
+
+    INDEX_HEADER current;
+    if(!indexSlot(path, &current, NULL))
+        return NULL;
+
+    strcpy(inSlot, INDEX_NAME);
+    FSStat stat;
+    uint8_t *file;
+    if(FSAGetStat(fsaClient, path, &stat) == FS_ERROR_OK && stat.size >= sizeof(INDEX_HEADER) && readFile(path, (void **)&file, stat.size) == FS_ERROR_OK)
+    {
+        // The count gets bounded first, the multiplication could wrap otherwise
+        INDEX_HEADER *cached = (INDEX_HEADER *)file;
+        if(cached->magic == INDEX_MAGIC && cached->files == current.files && cached->bytes == current.bytes && cached->stamp == current.stamp &&
+           cached->count <= (stat.size - sizeof(INDEX_HEADER)) / sizeof(INDEX_RECORD) && stat.size == sizeof(INDEX_HEADER) + cached->count * sizeof(INDEX_RECORD))
+        {
+            // Reuse the buffer, the records just have to move over the header
+            *count = cached->count;
+            OSBlockMove(file, file + sizeof(INDEX_HEADER), *count * sizeof(INDEX_RECORD), false);
+            ++cachedIndexes;
+            return (INDEX_RECORD *)file;
+        }
+
+        MEMFreeToDefaultHeap(file);
+    }
+
+    INDEX_RECORD *records = NULL;
+    *inSlot = '\0';
+    if(!indexSlot(path, &current, &records))
+        return NULL;
+
+    *count = current.count;
+
+    // The index is just a cache, so not being able to write it is no error
+    strcpy(inSlot, INDEX_NAME);
+    FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+    if(ret == FS_ERROR_OK)
+    {
+        writer.fill = 0;
+        ret = writeTicket(&writer, (uint8_t *)&current, sizeof(INDEX_HEADER));
+        if(ret == FS_ERROR_OK)
+            ret = writeTicket(&writer, (uint8_t *)records, *count * sizeof(INDEX_RECORD));
+        if(ret == FS_ERROR_OK)
+            ret = closeTicket(&writer);
+    }
+
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error writing %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+    }
+
+    return records;
+}
+
+// Finds the two newest slots on the SD card
+static bool findNewestSlots(uint16_t *older, uint16_t *newer)
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = SD_PATH;
+    FSADirectoryHandle dir;
+    if(FSAOpenDir(fsaClient, path, &dir) != FS_ERROR_OK)
+        return false;
+
+    size_t found = 0;
+    uint16_t current;
+    FSADirectoryEntry entry;
+    while(FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
+    {
+        if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
+            continue;
+
+        current = (uint16_t)strtol(entry.name, NULL, 16);
+        if(found == 0 || current > *newer)
+        {
+            *older = *newer;
+            *newer = current;
+            ++found;
+        }
+        else if(found == 1 || current > *older)
+        {
+            *older = current;
+            ++found;
+        }
+    }
+
+    FSACloseDir(fsaClient, dir);
+    return found >= 2;
+}
+
+static void writeDiffLine(void *ctx, DIFF_KIND kind, const INDEX_RECORD *record)
+{
+    static const char *const kindNames[DIFF_KINDS] = {
+        "added",
+        "removed",
+        "changed",
+    };
+
+    ++diffCounts[record->type][kind];
+    if(error)
+        return;
+
+    char line[80];
+    size_t len;
+    if(record->type == INDEX_RECORD_TICKET)
+        len = sprintf(line, "%s ticket %016llX %s\n", kindNames[kind], (unsigned long long)record->tid, record->name);
+    else
+        len = sprintf(line, "%s title.list %016llX\n", kindNames[kind], (unsigned long long)record->tid);
+
+    FSError ret = writeTicket(&writer, (uint8_t *)line, len);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error writing %s", DIFF_PATH);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+    }
+}
+
+// Compares two backup slots on the SD card (DIFF_NEWEST picks the two newest), see diffIndexes(). The details go to DIFF_PATH.
+static void diffBackups(uint16_t from, uint16_t to)
+{
+    for(size_t i = 0; i < INDEX_RECORD_TYPES; ++i)
+        for(size_t j = 0; j < DIFF_KINDS; ++j)
+            diffCounts[i][j] = 0;
+
+    bytesRead = 0;
+    cachedIndexes = 0;
+    if(from == DIFF_NEWEST || to == DIFF_NEWEST)
+    {
+        if(!findNewestSlots(&from, &to))
+        {
+            WHBLogPrint("There need to be at least two backups to compare!");
+            error = true;
+            return;
+        }
+    }
+
+    diffSlots[0] = from;
+    diffSlots[1] = to;
+
+    size_t fromCount;
+    size_t toCount;
+    INDEX_RECORD *toIndex = NULL;
+    INDEX_RECORD *fromIndex = loadSlotIndex(from, &fromCount);
+    if(!error)
+        toIndex = loadSlotIndex(to, &toCount);
+
+    if(!error)
+    {
+        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = DIFF_PATH;
+        FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+        if(ret == FS_ERROR_OK)
+        {
+            writer.fill = 0;
+            diffIndexes(fromIndex, fromCount, toIndex, toCount, writeDiffLine, NULL);
+
+            // writeTicket() closes the file on errors
+            if(!error)
+            {
+                ret = closeTicket(&writer);
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                }
+            }
+        }
+        else
+        {
+            WHBLogPrintf("Error opening %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+
+    if(fromIndex != NULL)
+        MEMFreeToDefaultHeap(fromIndex);
+    if(toIndex != NULL)
+        MEMFreeToDefaultHeap(toIndex);
+}
+
+// Replays the undo log: removed tickets get appended to their files again and dropped TIDs to title.list
+static void undoCleanup()
+{
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = UNDO_PATH;
+    FSStat stat;
+    arg0 = arg1 = 0;
+    FSError ret = FSAGetStat(fsaClient, path, &stat);
+    if(ret == FS_ERROR_NOT_FOUND)
+        return;
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error stating %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    uint8_t *log;
+    ret = readFile(path, (void **)&log, stat.size);
+    if(ret != FS_ERROR_OK)
+    {
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
+        error = true;
+        return;
+    }
+
+    // Worst case every record is a title.list entry
+    uint64_t *tids = MEMAllocFromDefaultHeap((stat.size / (sizeof(UNDO_RECORD) + sizeof(uint64_t)) + 1) * sizeof(uint64_t));
+    if(tids == NULL)
+    {
+        MEMFreeToDefaultHeap(log);
+        WHBLogPrint("EOM!");
+        error = true;
+        return;
+    }
+
+    bool fileOpen = false;
+    path[0] = '\0';
+    UNDO_RECORD record;
+    const char *recordPath;
+    for(size_t i = 0; !error && i < stat.size; i += record.pathSize + record.dataSize)
+    {
+        if(stat.size - i < sizeof(UNDO_RECORD))
+        {
+            WHBLogPrintf("%s is truncated!", UNDO_PATH);
+            error = true;
+            break;
+        }
+
+        OSBlockMove(&record, log + i, sizeof(UNDO_RECORD), false);
+        i += sizeof(UNDO_RECORD);
+        if(stat.size - i < record.pathSize || stat.size - i - record.pathSize < record.dataSize)
+        {
+            WHBLogPrintf("%s is truncated!", UNDO_PATH);
+            error = true;
+            break;
+        }
+
+        if(record.type == UNDO_RECORD_TITLE && record.pathSize == 0 && record.dataSize == sizeof(uint64_t))
+        {
+            OSBlockMove(tids + arg1, log + i, sizeof(uint64_t), false);
+            ++arg1;
+            continue;
+        }
+
+        recordPath = (const char *)(log + i);
+        if(record.type != UNDO_RECORD_TICKET || record.pathSize == 0 || record.pathSize > FS_MAX_PATH ||
+           recordPath[record.pathSize - 1] != '\0' || strncmp(recordPath, TICKET_BUCKET, strlen(TICKET_BUCKET)) != 0)
+        {
+            WHBLogPrintf("Invalid record in %s!", UNDO_PATH);
+            error = true;
+            break;
+        }
+
+        // Records of the same file follow each other, so open every file once only
+        if(strcmp(path, recordPath) != 0)
+        {
+            if(fileOpen)
+            {
+                ret = closeTicket(&writer);
+                fileOpen = false;
+                if(ret != FS_ERROR_OK)
+                {
+                    WHBLogPrintf("Error writing %s", path);
+                    WHBLogPrint(FSAGetStatusStr(ret));
+                    error = true;
+                    break;
+                }
+            }
+
+            strcpy(path, recordPath);
+            ret = FSAOpenFileEx(fsaClient, path, "a", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+            if(ret != FS_ERROR_OK)
+            {
+                WHBLogPrintf("Error opening %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+                break;
+            }
+
+            fileOpen = true;
+        }
+
+        ret = writeTicket(&writer, log + i + record.pathSize, record.dataSize);
+        if(ret != FS_ERROR_OK)
+        {
+            fileOpen = false;
+            WHBLogPrintf("Error writing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+            break;
+        }
+
+        ++arg0;
+    }
+
+    MEMFreeToDefaultHeap(log);
+    if(fileOpen)
+    {
+        ret = closeTicket(&writer);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error writing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+
+    if(!error && arg1 != 0)
+    {
+        strcpy(path, TICKET_LIST_PATH);
+        ret = FSAGetStat(fsaClient, path, &stat);
+        uint64_t *file = NULL;
+        if(ret == FS_ERROR_OK)
+            ret = readFile(path, (void **)&file, stat.size);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error reading %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+        else
+        {
+            ret = FSAOpenFileEx(fsaClient, path, "a", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+            if(ret == FS_ERROR_OK)
+            {
+                // Don't add entries twice, neither in case the title got reinstalled in the meantime nor when the log
+                // has a TID more than once. The copy of title.list only gets searched, so it's sorted as well.
+                arg1 = sortTids(tids, arg1);
+                size_t listed = sortTids(file, stat.size / sizeof(uint64_t));
+                for(size_t i = 0; !error && i < arg1; ++i)
+                {
+                    if(bsearch(tids + i, file, listed, sizeof(uint64_t), compareTids) == NULL)
+                    {
+                        ret = writeTicket(&writer, (uint8_t *)(tids + i), sizeof(uint64_t));
+                        if(ret != FS_ERROR_OK)
+                        {
+                            WHBLogPrintf("Error writing %s", path);
+                            WHBLogPrint(FSAGetStatusStr(ret));
+                            error = true;
+                        }
+                    }
+                }
+
+                if(!error)
+                {
+                    ret = closeTicket(&writer);
+                    if(ret != FS_ERROR_OK)
+                    {
+                        WHBLogPrintf("Error closing %s", path);
+                        WHBLogPrint(FSAGetStatusStr(ret));
+                        error = true;
+                    }
+                }
+            }
+            else
+            {
+                WHBLogPrintf("Error opening %s", path);
+                WHBLogPrint(FSAGetStatusStr(ret));
+                error = true;
+            }
+
+            MEMFreeToDefaultHeap(file);
+        }
+    }
+
+    MEMFreeToDefaultHeap(tids);
+
+    // Everything got restored, so the log must not be replayed again
+    if(!error)
+    {
+        strcpy(path, UNDO_PATH);
+        ret = FSARemove(fsaClient, path);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error removing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
+    }
+}
+
+static uint32_t homeCallback(void *ctx)
+{
+    uint64_t tid = OSGetTitleID();
+    if(tid == 0x0005000013374842 || (tid & 0xFFFFFFFFFFFFFCFF) == 0x000500101004A000) // HBL
+        SYSRelaunchTitle(0, NULL);
+    else
+        SYSLaunchMenu();
+
+// TODO: This causes a blackscreen in the Wii U menu
+//    WHBLogConsoleFree();
+    return 0;
+}
+
+int readInput()
+{
+    VPADReadError vError;
+    VPADStatus vpad;
+    VPADRead(VPAD_CHAN_0, &vpad, 1, &vError);
+    if(vError == VPAD_READ_SUCCESS && vpad.trigger)
+    {
+        vpad.trigger &= ~(VPAD_STICK_R_EMULATION_LEFT | VPAD_STICK_R_EMULATION_RIGHT | VPAD_STICK_R_EMULATION_UP | VPAD_STICK_R_EMULATION_DOWN | VPAD_BUTTON_HOME);
+        return vpad.trigger;
+    }
+
+    return 0;
+}
+
+static void batchLogHandler(const char *msg)
+{
+    size_t len = strlen(msg);
+    if(batchLogFill + len + 1 > BATCH_LOG_SIZE)
+        return;
+
+    OSBlockMove(batchLog + batchLogFill, msg, len, false);
+    batchLogFill += len;
+    batchLog[batchLogFill++] = '\n';
+}
+
+static bool parseBool(const char *value, bool *out)
+{
+    if(strcmp(value, "1") == 0 || strcmp(value, "on") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "true") == 0)
+        *out = true;
+    else if(strcmp(value, "0") == 0 || strcmp(value, "off") == 0 || strcmp(value, "no") == 0 || strcmp(value, "false") == 0)
+        *out = false;
+    else
+        return false;
 
-                MEMFreeToDefaultHeap(file);
-            }
+    return true;
+}
 
-            FSACloseDir(fsaClient, dir2);
-        }
+// Options are "key = value" lines and apply to all operations of the batch
+static bool parseBatchOption(char *line, char *value)
+{
+    char *key = line;
+    char *keyEnd = value;
+    while(keyEnd != key && (keyEnd[-1] == ' ' || keyEnd[-1] == '\t'))
+        --keyEnd;
+    *keyEnd = '\0';
+
+    for(++value; *value == ' ' || *value == '\t'; ++value)
+        ;
+
+    if(strcmp(key, "target") != 0)
+        for(char *c = value; *c != '\0'; ++c)
+            if(*c >= 'A' && *c <= 'Z')
+                *c += 'a' - 'A';
+
+    bool ok;
+    if(strcmp(key, "sparse") == 0)
+        ok = parseBool(value, &sparseScan);
+    else if(strcmp(key, "undo") == 0)
+        ok = parseBool(value, &undoLog);
+    else if(strcmp(key, "trace") == 0)
+        ok = parseBool(value, &traceCalls);
+    else if(strcmp(key, "dlcdedupe") == 0)
+        ok = parseBool(value, &dlcDedupe);
+    else if(strcmp(key, "select") == 0)
+    {
+        // Which ticket survives for a duplicated TID: the first one found or the one with the highest title version / ticket ID
+        ok = strcmp(value, "first") == 0 || strcmp(value, "best") == 0;
+        if(ok)
+            selectBest = value[0] == 'b';
+    }
+    else if(strcmp(key, "target") == 0)
+    {
+        // Every target line adds another place to backup to (instead of SD_PATH)
+        size_t len = strlen(value);
+        ok = backupTargetCount < MAX_BACKUP_TARGETS && strncmp(value, "/vol/", 5) == 0 && len < FS_MAX_PATH - 24;
+        if(ok)
+        {
+            while(len > 1 && value[len - 1] == '/')
+                value[--len] = '\0';
 
-        FSACloseDir(fsaClient, dir);
+            strcpy(backupTargets[backupTargetCount].path, value);
+            backupTargets[backupTargetCount++].baseLen = len;
+        }
+    }
+    else if(strcmp(key, "depth") == 0)
+    {
+        // Queue depth of the target above: the deeper it is, the further the other targets can get ahead while it's slow
+        char *end;
+        unsigned long depth = strtoul(value, &end, 10);
+        ok = backupTargetCount != 0 && end != value && *end == '\0' && depth != 0 && depth <= MAX_BACKUP_QUEUE_SIZE;
+        if(ok)
+            backupTargets[backupTargetCount - 1].depth = depth;
     }
     else
     {
-        WHBLogPrintf("Error opening %s", path);
-        WHBLogPrint(FSAGetStatusStr(ret));
-        error = true;
+        WHBLogPrintf("Unknown batch option: %s", key);
+        return false;
     }
 
-    if(error)
-        return;
+    if(!ok)
+        WHBLogPrintf("Invalid value for %s: %s", key, value);
 
-    strcpy(path, TICKET_LIST_PATH);
-    FSStat stat;
-    ret = FSAGetStat(fsaClient, path, &stat);
-    if(ret != FS_ERROR_OK)
-    {
-        WHBLogPrintf("Error stating %s", path);
-        WHBLogPrint(FSAGetStatusStr(ret));
-        error = true;
-        return;
-    }
+    return ok;
+}
 
-    ret = readFile(path, &file, stat.size);
-    if(ret != FS_ERROR_OK)
+static bool parseBatchLine(char *line)
+{
+    char *value = strchr(line, '=');
+    if(value != NULL)
+        return parseBatchOption(line, value);
+
+    if(batchOpCount == MAX_BATCH_OPS)
     {
-        WHBLogPrintf("Error opening %s", path);
-        WHBLogPrint(FSAGetStatusStr(ret));
-        error = true;
+        WHBLogPrintf("Too many batch operations (max. %u)!", MAX_BATCH_OPS);
+        return false;
     }
 
-    strcpy(inSD, "title.list");
-    ret = FSAOpenFileEx(fsaClient, sdPath, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &fileHandle);
-    if(ret == FS_ERROR_OK)
+    if(strcmp(line, "backup") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_BACKUP;
+    else if(strcmp(line, "cleanup") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_CLEANUP;
+    else if(strcmp(line, "verify") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_VERIFY;
+    else if(strcmp(line, "undo") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_UNDO;
+    else if(strcmp(line, "resume") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_RESUME;
+    else if(strcmp(line, "plan") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_PLAN;
+    else if(strcmp(line, "apply") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_APPLY;
+    else if(strcmp(line, "maintain") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_MAINTAIN;
+    else if(strcmp(line, "check") == 0)
+        batchOps[batchOpCount++] = BATCH_OP_CHECK;
+    else if(strcmp(line, "diff") == 0 || strncmp(line, "diff ", 5) == 0)
     {
-        ret = FSAWriteFile(fsaClient, file, stat.size, 1, fileHandle, 0);
-        if(ret != 1)
+        // "diff" compares the two newest backups, "diff 0001 0003" the given slots
+        uint16_t *slots = batchDiffSlots[batchOpCount];
+        slots[0] = slots[1] = DIFF_NEWEST;
+        if(line[4] != '\0')
         {
-            WHBLogPrintf("Error writing %s", sdPath);
-            WHBLogPrint(FSAGetStatusStr(ret));
-            error = true;
-        }
+            char *end;
+            unsigned long from = strtoul(line + 5, &end, 16);
+            char *second = end;
+            unsigned long to = strtoul(second, &end, 16);
+            if(end == second || *end != '\0' || from >= DIFF_NEWEST || to >= DIFF_NEWEST)
+            {
+                WHBLogPrintf("Invalid backup slots: %s", line + 5);
+                return false;
+            }
 
-        ret = FSACloseFile(fsaClient, fileHandle);
-        if(ret != FS_ERROR_OK)
-        {
-            WHBLogPrintf("Error closing %s", sdPath);
-            WHBLogPrint(FSAGetStatusStr(ret));
-            error = true;
+            slots[0] = (uint16_t)from;
+            slots[1] = (uint16_t)to;
         }
+
+        batchOps[batchOpCount++] = BATCH_OP_DIFF;
+    }
+    else
+    {
+        WHBLogPrintf("Unknown batch operation: %s", line);
+        return false;
     }
 
-    MEMFreeToDefaultHeap(file);
+    return true;
 }
 
-static void deleteTickets()
+// Returns true if a batch config exists on the SD card, even if it's invalid (in which case error is set)
+static bool readBatchConfig()
 {
-    LIST *handledIds = createList();
-    if(handledIds == NULL)
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = BATCH_PATH;
+    FSStat stat;
+    if(FSAGetStat(fsaClient, path, &stat) != FS_ERROR_OK)
+        return false;
+
+    char *file;
+    FSError ret = readFile(path, (void **)&file, stat.size);
+    if(ret != FS_ERROR_OK)
     {
-        WHBLogPrint("EOM!");
+        WHBLogPrintf("Error reading %s", path);
+        WHBLogPrint(FSAGetStatusStr(ret));
         error = true;
-        return;
+        return true;
     }
 
-    LIST *ticketList = createList();
-    if(ticketList != NULL)
+    // Keys and operations are case insensitive, values get handled by parseBatchOption() as paths need their case
+    char line[MAX_BATCH_LINE];
+    size_t len = 0;
+    bool inValue = false;
+    char c;
+    for(size_t i = 0; !error && i <= stat.size; ++i)
     {
-        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TICKET_BUCKET;
-        char *inSentence = path + strlen(TICKET_BUCKET);
-        FSADirectoryHandle dir;
-        FSError ret = FSAOpenDir(fsaClient, path, &dir);
-        if(ret == FS_ERROR_OK)
+        c = i == stat.size ? '\n' : file[i];
+        if(c == '\n' || c == '\r' || c == '#')
         {
-            FSADirectoryEntry entry;
-            FSADirectoryHandle dir2;
-            char *fileName;
-            void *file;
-            TICKET *ticket;
-            TICKET_SECTION *sec;
-            bool keep;
-            bool modified;
-            uint64_t *tid;
-            uint8_t *fileEnd;
-            uint8_t *ptr;
-            MCPTitleListType titleEntry __attribute__((__aligned__(0x40)));
-            arg0 = 0;
+            // Skip comments till the end of the line
+            if(c == '#')
+                while(i + 1 < stat.size && file[i + 1] != '\n')
+                    ++i;
 
-            // Loop through all the folder inside of the ticket bucket
-            while(!error && FSAReadDir(fsaClient, dir, &entry) == FS_ERROR_OK)
-            {
-                if(entry.name[0] == '.' || !(entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 4)
-                    continue;
+            while(len != 0 && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+                --len;
 
-                strcpy(inSentence, entry.name);
-                ret = FSAOpenDir(fsaClient, path, &dir2);
-                if(ret != FS_ERROR_OK)
-                {
-                    WHBLogPrintf("Error opening %s", path);
-                    WHBLogPrint(FSAGetStatusStr(ret));
+            if(len != 0)
+            {
+                line[len] = '\0';
+                if(!parseBatchLine(line))
                     error = true;
-                    break;
-                }
-
-                strcat(inSentence, "/");
-                fileName = inSentence + strlen(inSentence);
-                // Loop through all the subfolders
-                while(!error && FSAReadDir(fsaClient, dir2, &entry) == FS_ERROR_OK)
-                {
-                    if(entry.name[0] == '.' || (entry.info.flags & FS_STAT_DIRECTORY) || strlen(entry.name) != 12)
-                        continue;
-
-                    strcpy(fileName, entry.name);
-                    ret = readFile(path, &file, entry.info.size);
-                    if(ret != FS_ERROR_OK)
-                    {
-                        WHBLogPrintf("Error reading %s", path);
-                        WHBLogPrint(FSAGetStatusStr(ret));
-                        error = true;
-                        break;
-                    }
-
-                    ticket = (TICKET *)file;
-                    fileEnd = ((uint8_t *)file) + entry.info.size;
-                    modified = false;
-                    // Loop through all the tickets inside of a file
-                    while(!error)
-                    {
-                        ptr = ((uint8_t *)ticket) + sizeof(TICKET);
-                        if(ticket->total_hdr_size > 0x14)
-                            ptr += ticket->total_hdr_size - 0x14;
-
-                        keep = true;
-                        // Check that title is installed
-                        if(MCP_GetTitleInfo(mcpHandle, ticket->tid, &titleEntry) != 0)
-                            keep = false;
-                        // Check for duplicated tickets (ignoring DLC tickets)
-                        else if(!isDLC(ticket->tid))
-                        {
-                            forEachListEntry(handledIds, tid)
-                            {
-                                if(ticket->tid == *tid)
-                                {
-                                    keep = false;
-                                    break;
-                                }
-                            }
-                        }
-
-                        if(keep)
-                        {
-                            if(!isDLC(ticket->tid))
-                            {
-                                tid = MEMAllocFromDefaultHeap(sizeof(uint64_t));
-                                if(!tid)
-                                {
-                                    WHBLogPrint("EOM!");
-                                    error = true;
-                                    break;
-                                }
-                                if(!addToListEnd(handledIds, tid))
-                                {
-                                    MEMFreeToDefaultHeap(tid);
-                                    WHBLogPrint("EOM!");
-                                    error = true;
-                                    break;
-                                }
-
-                                *tid = ticket->tid;
-                            }
-
-                            sec = MEMAllocFromDefaultHeap(sizeof(TICKET_SECTION));
-                            if(!sec)
-                            {
-                                WHBLogPrint("EOM!");
-                                error = true;
-                                break;
-                            }
-                            if(!addToListEnd(ticketList, sec))
-                            {
-                                MEMFreeToDefaultHeap(sec);
-                                WHBLogPrint("EOM!");
-                                error = true;
-                                break;
-                            }
-
-                            sec->start = (uint8_t *)ticket;
-                            sec->size = ptr - sec->start;
-                        }
-                        else
-                        {
-                            ++arg0;
-                            modified = true;
-                        }
-
-                        if(ptr == fileEnd)
-                            break;
-                        if(ptr > fileEnd)
-                        {
-                            WHBLogPrintf("Filesize missmatch at %s!", path);
-                            error = true;
-                            break;
-                        }
-
-                        ticket = (TICKET *)ptr;
-                    }
-
-                    // In case there was a matching ticket inside of the file either delete or recreate it with the remembered tickets only
-                    if(!error && modified)
-                    {
-                        if(getListSize(ticketList) == 0)
-                        {
-                            ret = FSARemove(fsaClient, path);
-                            if(ret != FS_ERROR_OK)
-                            {
-                                WHBLogPrintf("Error removing %s", path);
-                                WHBLogPrint(FSAGetStatusStr(ret));
-                                error = true;
-                            }
-                        }
-                        else
-                        {
-                            ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &fileHandle);
-                            if(ret == FS_ERROR_OK)
-                            {
-                                forEachListEntry(ticketList, sec)
-                                {
-                                    ret = writeTicket(sec->start, sec->size);
-                                    if(ret != FS_ERROR_OK)
-                                    {
-                                        WHBLogPrintf("Error writing %s", path);
-                                        WHBLogPrint(FSAGetStatusStr(ret));
-                                        error = true;
-                                    }
-                                }
-
-                                if(!error)
-                                {
-                                    ret = closeTicket();
-                                    if(ret != FS_ERROR_OK)
-                                    {
-                                        WHBLogPrintf("Error writing %s", path);
-                                        WHBLogPrint(FSAGetStatusStr(ret));
-                                        error = true;
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                WHBLogPrintf("Error opening %s", path);
-                                WHBLogPrint(FSAGetStatusStr(ret));
-                                error = true;
-                            }
-                        }
-                    }
-
-                    clearList(ticketList, true);
-                    MEMFreeToDefaultHeap(file);
-                }
 
-                FSACloseDir(fsaClient, dir2);
+                len = 0;
             }
 
-            FSACloseDir(fsaClient, dir);
+            inValue = false;
         }
-        else
+        else if((len != 0 || (c != ' ' && c != '\t')) && len < MAX_BATCH_LINE - 1)
         {
-            WHBLogPrintf("Error opening %s", path);
-            WHBLogPrint(FSAGetStatusStr(ret));
-            error = true;
-        }
+            if(c == '=')
+                inValue = true;
 
-        destroyList(ticketList, true);
+            line[len++] = !inValue && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+        }
     }
-    else
+
+    MEMFreeToDefaultHeap(file);
+    if(!error && batchOpCount == 0)
     {
-        WHBLogPrint("EOM!");
+        WHBLogPrintf("No operations in %s", BATCH_PATH);
         error = true;
     }
 
-    destroyList(handledIds, true);
-    if(!error)
-        cleanTitleList();
+    return true;
 }
 
-static uint32_t homeCallback(void *ctx)
+static void writeBatchLog()
 {
-    uint64_t tid = OSGetTitleID();
-    if(tid == 0x0005000013374842 || (tid & 0xFFFFFFFFFFFFFCFF) == 0x000500101004A000) // HBL
-        SYSRelaunchTitle(0, NULL);
-    else
-        SYSLaunchMenu();
+    char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = BATCH_LOG_PATH;
+    FSError ret = FSAOpenFileEx(fsaClient, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &writer.handle);
+    if(ret != FS_ERROR_OK)
+        return;
 
-// TODO: This causes a blackscreen in the Wii U menu
-//    WHBLogConsoleFree();
-    return 0;
+    if(writeTicket(&writer, (uint8_t *)batchLog, batchLogFill) == FS_ERROR_OK)
+        closeTicket(&writer);
 }
 
-static bool procLoop()
+// Runs the operations from the batch config without any user interaction or screen updates, then exits to the menu
+static void batchLoop()
 {
-    switch(ProcUIProcessMessages(true))
+    ProcUIInit(OSSavesDone_ReadyToRelease);
+    ProcUIRegisterCallback(PROCUI_CALLBACK_HOME_BUTTON_DENIED, homeCallback, NULL, 100);
+    OSEnableHomeButtonMenu(false);
+
+    WHBAddLogHandler(batchLogHandler);
+    OSTime start;
+    for(size_t i = 0; !error && i < batchOpCount; ++i)
     {
-        case PROCUI_STATUS_EXITING:
-            return false;
-        case PROCUI_STATUS_RELEASE_FOREGROUND:
-            ProcUIDrawDoneRelease();
-        default:
-            return true;
+        start = OSGetSystemTime();
+        switch(batchOps[i])
+        {
+            case BATCH_OP_BACKUP:
+                backupTickets();
+                WHBLogPrintf("backup: %u ticket files saved (%u ms)", arg0, (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                if(!error)
+                    printBackupResults();
+                break;
+            case BATCH_OP_CLEANUP:
+                deleteTickets(false);
+                WHBLogPrintf("cleanup: %u tickets deleted (%u identical DLC tickets) and %u entries removed from title.list (%u KB read, %u ms)", arg0, dlcDuplicates, arg1, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_VERIFY:
+                deleteTickets(true);
+                WHBLogPrintf("verify: %s, %u tickets and %u title.list entries left to clean (%u KB read, %u ms)", arg0 == 0 && arg1 == 0 ? "OK" : "FAILED", arg0, arg1, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_UNDO:
+                undoCleanup();
+                WHBLogPrintf("undo: %u tickets and %u title.list entries restored (%u ms)", arg0, arg1, (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_PLAN:
+                planCleanup();
+                WHBLogPrintf("plan: %u tickets in %u files and %u title.list entries to remove (%u KB read, %u ms)", arg0, plannedFiles, arg1, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_APPLY:
+                applyPlan();
+                WHBLogPrintf("apply: %u tickets deleted and %u entries removed from title.list (%u ms)", arg0, arg1, (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_MAINTAIN:
+                backupAndClean();
+                WHBLogPrintf("maintain: %u tickets deleted and %u entries removed from title.list (%u KB read, %u ms)", arg0, arg1, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                if(!error)
+                {
+                    printBackupResults();
+                    printFusedBackupWarning();
+                }
+                break;
+            case BATCH_OP_CHECK:
+                checkConsistency();
+                WHBLogPrintf("check: %u title.list entries without ticket, %u installed titles not in title.list, %u tickets of uninstalled titles (%u KB read, %u ms)",
+                             checkCounts[CHECK_NO_TICKET], checkCounts[CHECK_NOT_LISTED], checkCounts[CHECK_NOT_INSTALLED], (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_DIFF:
+                diffBackups(batchDiffSlots[i][0], batchDiffSlots[i][1]);
+                WHBLogPrintf("diff %04X -> %04X: %u tickets added, %u removed and %u changed, %u title.list entries added and %u removed (%u of 2 indexes cached, %u KB read, %u ms)",
+                             diffSlots[0], diffSlots[1], diffCounts[INDEX_RECORD_TICKET][DIFF_ADDED], diffCounts[INDEX_RECORD_TICKET][DIFF_REMOVED], diffCounts[INDEX_RECORD_TICKET][DIFF_CHANGED],
+                             diffCounts[INDEX_RECORD_TITLE_LIST][DIFF_ADDED], diffCounts[INDEX_RECORD_TITLE_LIST][DIFF_REMOVED], cachedIndexes, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                break;
+            case BATCH_OP_RESUME:
+                if(!loadCheckpoint())
+                {
+                    if(!error)
+                        WHBLogPrint("resume: nothing to resume");
+                }
+                else if(checkpoint.op == CHECKPOINT_OP_BACKUP)
+                {
+                    WHBLogPrintf("resume: backup with %u buckets done", checkpoint.bucketCount);
+                    backupTickets();
+                    WHBLogPrintf("backup: %u ticket files saved (%u ms)", arg0, (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                    if(!error)
+                        printBackupResults();
+                }
+                else
+                {
+                    WHBLogPrintf("resume: cleanup with %u buckets done", checkpoint.bucketCount);
+                    deleteTickets(false);
+                    WHBLogPrintf("cleanup: %u tickets deleted (%u identical DLC tickets) and %u entries removed from title.list (%u KB read, %u ms)", arg0, dlcDuplicates, arg1, (uint32_t)(bytesRead / 1024), (uint32_t)OSTicksToMilliseconds(OSGetSystemTime() - start));
+                }
+
+                restoreUserFlags();
+                break;
+        }
     }
-}
 
-int readInput()
-{
-    VPADReadError vError;
-    VPADStatus vpad;
-    VPADRead(VPAD_CHAN_0, &vpad, 1, &vError);
-    if(vError == VPAD_READ_SUCCESS && vpad.trigger)
+    if(tracing)
     {
-        vpad.trigger &= ~(VPAD_STICK_R_EMULATION_LEFT | VPAD_STICK_R_EMULATION_RIGHT | VPAD_STICK_R_EMULATION_UP | VPAD_STICK_R_EMULATION_DOWN | VPAD_BUTTON_HOME);
-        return vpad.trigger;
+        char path[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = TRACE_PATH;
+        FSError ret = traceFlush(fsaClient, path);
+        if(ret != FS_ERROR_OK)
+        {
+            WHBLogPrintf("Error writing %s", path);
+            WHBLogPrint(FSAGetStatusStr(ret));
+            error = true;
+        }
     }
 
-    return 0;
+    WHBLogPrint(error ? "Batch aborted!" : "Batch finished!");
+    WHBRemoveLogHandler(batchLogHandler);
+    writeBatchLog();
+
+    // Errors end up in the log, there's nobody to read them from the screen
+    error = false;
+    homeCallback(NULL);
+    while(procLoop())
+        OSSleepTicks(OSMillisecondsToTicks(1000 / 60));
 }
 
 void mainLoop()
@@ -737,6 +3692,14 @@ void mainLoop()
     LOOP_STATE state = LOOP_STATE_MAIN_MENU;
     LOOP_STATE oldState = LOOP_STATE_INVALID;
     int buttons;
+    bool canUndo = false;
+    bool canResume = false;
+    bool canDiff = false;
+    uint16_t olderSlot;
+    uint16_t newerSlot;
+    char undoPath[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = UNDO_PATH;
+    char checkpointPath[FS_ALIGN(FS_MAX_PATH)] __attribute__((__aligned__(0x40))) = CHECKPOINT_PATH;
+    FSStat stat;
     while(!error && procLoop())
     {
         if(state != oldState)
@@ -747,11 +3710,22 @@ void mainLoop()
             switch(state)
             {
                 case LOOP_STATE_MAIN_MENU:
+                    canUndo = FSAGetStat(fsaClient, undoPath, &stat) == FS_ERROR_OK;
+                    canResume = FSAGetStat(fsaClient, checkpointPath, &stat) == FS_ERROR_OK;
+                    canDiff = findNewestSlots(&olderSlot, &newerSlot);
                     WHBLogPrint("Special thanks to: Ingunar");
                     WHBLogPrint("");
                     WHBLogPrint("");
                     WHBLogPrint("Press (A) to delete unused tickets.");
                     WHBLogPrint("Press (B) to backup all tickets.");
+                    WHBLogPrint("Press (X) to backup and delete unused tickets in one go.");
+                    WHBLogPrint("Press (Y) to check title.list against the tickets.");
+                    if(canUndo)
+                        WHBLogPrint("Press (-) to undo the deletions.");
+                    if(canResume)
+                        WHBLogPrint("Press (+) to resume the interrupted run.");
+                    if(canDiff)
+                        WHBLogPrintf("Press (R) to compare backup %04X to %04X.", olderSlot, newerSlot);
                     WHBLogPrint("Press (HOME) to exit.");
                     break;
                 case LOOP_STATE_DELETING:
@@ -759,6 +3733,7 @@ void mainLoop()
                     break;
                 case LOOP_STATE_DELETED:
                     WHBLogPrintf("%u tickets deleted and %u entries removed from title.list!", arg0, arg1);
+                    WHBLogPrintf("%u KB read from the SLC.", (uint32_t)(bytesRead / 1024));
                     WHBLogPrint("");
                     WHBLogPrint("Press (B) to go back.");
                     WHBLogPrint("Press (HOME) to exit.");
@@ -768,6 +3743,56 @@ void mainLoop()
                     break;
                 case LOOP_STATE_BACKUPED:
                     WHBLogPrintf("%u ticket files saved!", arg0);
+                    printBackupResults();
+                    WHBLogPrint("");
+                    WHBLogPrint("Press (B) to go back.");
+                    WHBLogPrint("Press (HOME) to exit.");
+                    break;
+                case LOOP_STATE_UNDOING:
+                    WHBLogPrint("Restoring deleted tickets, this might take some time...");
+                    break;
+                case LOOP_STATE_UNDONE:
+                    WHBLogPrintf("%u tickets and %u title.list entries restored!", arg0, arg1);
+                    WHBLogPrint("");
+                    WHBLogPrint("Press (B) to go back.");
+                    WHBLogPrint("Press (HOME) to exit.");
+                    break;
+                case LOOP_STATE_RESUMING:
+                    WHBLogPrint("Resuming, this might take some time...");
+                    break;
+                case LOOP_STATE_CHECKING:
+                    WHBLogPrint("Checking tickets, this might take some time...");
+                    break;
+                case LOOP_STATE_CHECKED:
+                    WHBLogPrintf("%u title.list entries without ticket.", checkCounts[CHECK_NO_TICKET]);
+                    WHBLogPrintf("%u installed titles not in title.list.", checkCounts[CHECK_NOT_LISTED]);
+                    WHBLogPrintf("%u tickets of uninstalled titles.", checkCounts[CHECK_NOT_INSTALLED]);
+                    if(checkWritten)
+                        WHBLogPrint("Details got written to " CHECK_PATH);
+                    WHBLogPrint("");
+                    WHBLogPrint("Press (B) to go back.");
+                    WHBLogPrint("Press (HOME) to exit.");
+                    break;
+                case LOOP_STATE_DIFFING:
+                    WHBLogPrint("Comparing backups, this might take some time...");
+                    break;
+                case LOOP_STATE_DIFFED:
+                    WHBLogPrintf("Changes from backup %04X to %04X:", diffSlots[0], diffSlots[1]);
+                    WHBLogPrintf("%u tickets added, %u removed and %u changed.", diffCounts[INDEX_RECORD_TICKET][DIFF_ADDED], diffCounts[INDEX_RECORD_TICKET][DIFF_REMOVED], diffCounts[INDEX_RECORD_TICKET][DIFF_CHANGED]);
+                    WHBLogPrintf("%u title.list entries added and %u removed.", diffCounts[INDEX_RECORD_TITLE_LIST][DIFF_ADDED], diffCounts[INDEX_RECORD_TITLE_LIST][DIFF_REMOVED]);
+                    WHBLogPrint("Details got written to " DIFF_PATH);
+                    WHBLogPrint("");
+                    WHBLogPrint("Press (B) to go back.");
+                    WHBLogPrint("Press (HOME) to exit.");
+                    break;
+                case LOOP_STATE_MAINTAINING:
+                    WHBLogPrint("Creating backup and deleting tickets, this might take some time...");
+                    break;
+                case LOOP_STATE_MAINTAINED:
+                    WHBLogPrintf("%u tickets deleted and %u entries removed from title.list!", arg0, arg1);
+                    WHBLogPrintf("%u KB read from the SLC.", (uint32_t)(bytesRead / 1024));
+                    printBackupResults();
+                    printFusedBackupWarning();
                     WHBLogPrint("");
                     WHBLogPrint("Press (B) to go back.");
                     WHBLogPrint("Press (HOME) to exit.");
@@ -788,17 +3813,55 @@ void mainLoop()
                     state = LOOP_STATE_DELETING;
                 else if(buttons & VPAD_BUTTON_B)
                     state = LOOP_STATE_BACKING_UP;
+                else if(buttons & VPAD_BUTTON_X)
+                    state = LOOP_STATE_MAINTAINING;
+                else if(buttons & VPAD_BUTTON_Y)
+                    state = LOOP_STATE_CHECKING;
+                else if(canUndo && (buttons & VPAD_BUTTON_MINUS))
+                    state = LOOP_STATE_UNDOING;
+                else if(canResume && (buttons & VPAD_BUTTON_PLUS))
+                    state = LOOP_STATE_RESUMING;
+                else if(canDiff && (buttons & VPAD_BUTTON_R))
+                    state = LOOP_STATE_DIFFING;
+                break;
+            case LOOP_STATE_RESUMING:
+                if(loadCheckpoint())
+                    state = checkpoint.op == CHECKPOINT_OP_BACKUP ? LOOP_STATE_BACKING_UP : LOOP_STATE_DELETING;
+                else
+                    state = 0;
                 break;
             case LOOP_STATE_DELETING:
-                deleteTickets();
+                deleteTickets(false);
+                restoreUserFlags();
                 state = LOOP_STATE_DELETED;
                 break;
             case LOOP_STATE_BACKING_UP:
                 backupTickets();
+                restoreUserFlags();
                 state = LOOP_STATE_BACKUPED;
                 break;
+            case LOOP_STATE_UNDOING:
+                undoCleanup();
+                state = LOOP_STATE_UNDONE;
+                break;
+            case LOOP_STATE_MAINTAINING:
+                backupAndClean();
+                state = LOOP_STATE_MAINTAINED;
+                break;
+            case LOOP_STATE_CHECKING:
+                checkConsistency();
+                state = LOOP_STATE_CHECKED;
+                break;
+            case LOOP_STATE_DIFFING:
+                diffBackups(olderSlot, newerSlot);
+                state = LOOP_STATE_DIFFED;
+                break;
             case LOOP_STATE_DELETED:
             case LOOP_STATE_BACKUPED:
+            case LOOP_STATE_UNDONE:
+            case LOOP_STATE_MAINTAINED:
+            case LOOP_STATE_CHECKED:
+            case LOOP_STATE_DIFFED:
                 if(buttons & VPAD_BUTTON_B)
                     state = 0;
                 break;
@@ -812,8 +3875,8 @@ int main()
 {
     bool initted = false;
     WHBLogConsoleInit();
-    writeBuffer = MEMAllocFromDefaultHeapEx(FS_ALIGN(WRITE_BUFSIZE), 0x40);
-    if(writeBuffer != NULL)
+    writer.buffer = MEMAllocFromDefaultHeapEx(FS_ALIGN(WRITE_BUFSIZE), 0x40);
+    if(writer.buffer != NULL)
     {
         FSAInit();
         fsaClient = FSAAddClient(NULL);
@@ -833,7 +3896,28 @@ int main()
                         {
                             initted = true;
                             WHBLogConsoleSetColor(COLOR_BACKGROUND);
-                            mainLoop();
+                            if(readBatchConfig())
+                            {
+                                if(!error)
+                                {
+                                    batchLog = MEMAllocFromDefaultHeap(BATCH_LOG_SIZE);
+                                    if(batchLog != NULL && (!traceCalls || traceInit()))
+                                    {
+                                        batchLoop();
+                                        MEMFreeToDefaultHeap(batchLog);
+                                    }
+                                    else
+                                    {
+                                        if(batchLog != NULL)
+                                            MEMFreeToDefaultHeap(batchLog);
+
+                                        WHBLogPrint("EOM!");
+                                        error = true;
+                                    }
+                                }
+                            }
+                            else
+                                mainLoop();
                             MCP_Close(mcpHandle);
                         }
                         else
@@ -873,7 +3957,7 @@ int main()
         }
 
         FSAShutdown();
-        MEMFreeToDefaultHeap(writeBuffer);
+        MEMFreeToDefaultHeap(writer.buffer);
     }
     else
     {
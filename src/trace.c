@@ -0,0 +1,231 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+
+// We need the real functions in here
+#define TRACE_NO_WRAPPERS
+#include <trace.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/memdefaultheap.h>
+#include <coreinit/memory.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+
+#define FS_ALIGN(x)       ((x + 0x3F) & ~(0x3F))
+#define TRACE_EVENTS      8192 // Ring buffer size, older events get overwritten
+#define TRACE_PATH_SIZE   64
+#define TRACE_HANDLES     32
+#define TRACE_BUFSIZE     (64 * 1024) // 64 KB
+#define TRACE_LINE_SIZE   (TRACE_PATH_SIZE * 2 + 192) // Escaping might double the path
+#define TRACE_TRAILER     "\n]}\n"
+
+typedef struct
+{
+    OSTime start;
+    OSTime end;
+    uint64_t tid;
+    uint32_t thread;
+    uint32_t bytes;
+    int32_t result;
+    TRACE_OP op;
+    char path[TRACE_PATH_SIZE];
+} TRACE_EVENT;
+
+// Reads and writes only know the handle, so remember which path belongs to it
+typedef struct
+{
+    int32_t handle;
+    bool dir;
+    char path[TRACE_PATH_SIZE];
+} TRACE_HANDLE;
+
+static const char *const traceNames[] = {
+    "FSAOpenFileEx",
+    "FSAOpenDir",
+    "FSAReadFile",
+    "FSAWriteFile",
+    "FSARemove",
+    "FSAReadDir",
+    "MCP_GetTitleInfo",
+};
+
+bool tracing = false;
+static TRACE_EVENT *traceEvents = NULL;
+static uint32_t traceCount = 0;
+static TRACE_HANDLE traceHandles[TRACE_HANDLES];
+static uint32_t traceHandleCount = 0;
+static OSTime traceBase;
+
+bool traceInit()
+{
+    traceEvents = MEMAllocFromDefaultHeap(sizeof(TRACE_EVENT) * TRACE_EVENTS);
+    if(traceEvents == NULL)
+        return false;
+
+    traceCount = traceHandleCount = 0;
+    traceBase = OSGetSystemTime();
+    tracing = true;
+    return true;
+}
+
+// Keep the end of long paths, that's where the interesting part is
+static void tracePath(char *out, const char *path)
+{
+    size_t len = strlen(path);
+    if(len >= TRACE_PATH_SIZE)
+        path += len - (TRACE_PATH_SIZE - 1);
+
+    strcpy(out, path);
+}
+
+static const char *handlePath(int32_t handle, bool dir)
+{
+    uint32_t count = traceHandleCount < TRACE_HANDLES ? traceHandleCount : TRACE_HANDLES;
+    for(uint32_t i = 0; i < count; ++i)
+        if(traceHandles[i].handle == handle && traceHandles[i].dir == dir)
+            return traceHandles[i].path;
+
+    return NULL;
+}
+
+void traceEvent(TRACE_OP op, const char *path, int32_t handle, uint32_t bytes, uint64_t tid, int32_t result, OSTime start)
+{
+    OSTime end = OSGetSystemTime();
+    bool dir = op == TRACE_OP_OPEN_DIR || op == TRACE_OP_READ_DIR;
+    if((op == TRACE_OP_OPEN || op == TRACE_OP_OPEN_DIR) && result == FS_ERROR_OK)
+    {
+        // Handles get reused after closing, so a simple ring is good enough
+        TRACE_HANDLE *entry = traceHandles + (__atomic_fetch_add(&traceHandleCount, 1, __ATOMIC_RELAXED) % TRACE_HANDLES);
+        entry->handle = handle;
+        entry->dir = dir;
+        tracePath(entry->path, path);
+    }
+    else if(path == NULL && op != TRACE_OP_TITLE_INFO)
+        path = handlePath(handle, dir);
+
+    TRACE_EVENT *event = traceEvents + (__atomic_fetch_add(&traceCount, 1, __ATOMIC_RELAXED) % TRACE_EVENTS);
+    event->start = start;
+    event->end = end;
+    event->tid = tid;
+    event->thread = (uint32_t)OSGetCurrentThread();
+    event->bytes = bytes;
+    event->result = result;
+    event->op = op;
+    if(path == NULL)
+        event->path[0] = '\0';
+    else
+        tracePath(event->path, path);
+}
+
+// Copies a path into a JSON string, returns the bytes written
+static size_t escapePath(char *out, const char *path)
+{
+    char *start = out;
+    for(; *path != '\0'; ++path)
+    {
+        if(*path == '"' || *path == '\\')
+            *out++ = '\\';
+
+        *out++ = *path;
+    }
+
+    *out = '\0';
+    return out - start;
+}
+
+// Writes the ring buffer as Chrome trace-event JSON (load it in chrome://tracing or Perfetto) and stops tracing
+FSError traceFlush(FSAClientHandle client, char *path)
+{
+    if(!tracing)
+        return FS_ERROR_OK;
+
+    tracing = false;
+    uint8_t *buffer = MEMAllocFromDefaultHeapEx(FS_ALIGN(TRACE_BUFSIZE), 0x40);
+    if(buffer == NULL)
+    {
+        MEMFreeToDefaultHeap(traceEvents);
+        traceEvents = NULL;
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    FSAFileHandle handle;
+    FSError ret = FSAOpenFileEx(client, path, "w", 0x660, FS_OPEN_FLAG_NONE, 0, &handle);
+    if(ret == FS_ERROR_OK)
+    {
+        size_t fill = sprintf((char *)buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        uint32_t first = traceCount > TRACE_EVENTS ? traceCount - TRACE_EVENTS : 0;
+        TRACE_EVENT *event;
+        for(uint32_t i = first; i < traceCount; ++i)
+        {
+            // Keep room for the trailer, it gets added without checking
+            if(TRACE_BUFSIZE - fill < TRACE_LINE_SIZE + sizeof(TRACE_TRAILER))
+            {
+                ret = FSAWriteFile(client, buffer, fill, 1, handle, 0);
+                if(ret != 1)
+                {
+                    // A short write isn't an error code but the trace is incomplete all the same, so no trailer for it
+                    if(ret >= 0)
+                        ret = FS_ERROR_STORAGE_FULL;
+
+                    break;
+                }
+
+                ret = FS_ERROR_OK;
+                fill = 0;
+            }
+
+            event = traceEvents + (i % TRACE_EVENTS);
+            fill += sprintf((char *)buffer + fill, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu,\"args\":{",
+                            i == first ? "" : ",\n",
+                            traceNames[event->op], event->op == TRACE_OP_TITLE_INFO ? "mcp" : "fsa", event->thread,
+                            (unsigned long long)OSTicksToMicroseconds(event->start - traceBase),
+                            (unsigned long long)OSTicksToMicroseconds(event->end - event->start));
+            if(event->op == TRACE_OP_TITLE_INFO)
+                fill += sprintf((char *)buffer + fill, "\"tid\":\"%016llX\"", (unsigned long long)event->tid);
+            else
+            {
+                fill += sprintf((char *)buffer + fill, "\"path\":\"");
+                fill += escapePath((char *)buffer + fill, event->path);
+                fill += sprintf((char *)buffer + fill, "\",\"bytes\":%u", event->bytes);
+            }
+
+            fill += sprintf((char *)buffer + fill, ",\"result\":%d}}", event->result);
+        }
+
+        if(ret == FS_ERROR_OK)
+        {
+            fill += sprintf((char *)buffer + fill, TRACE_TRAILER);
+            ret = FSAWriteFile(client, buffer, fill, 1, handle, 0);
+            ret = ret == 1 ? FS_ERROR_OK : ret < 0 ? ret : FS_ERROR_STORAGE_FULL;
+        }
+
+        FSError ret2 = FSACloseFile(client, handle);
+        if(ret == FS_ERROR_OK)
+            ret = ret2;
+    }
+
+    MEMFreeToDefaultHeap(buffer);
+    MEMFreeToDefaultHeap(traceEvents);
+    traceEvents = NULL;
+    return ret;
+}
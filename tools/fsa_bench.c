@@ -0,0 +1,641 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+
+// Native benchmark running the I/O patterns of deleteTickets() and backupTickets() against fsa_emu.h, sweeping
+// the knobs that can't be tuned on a PC otherwise.
+// Usage: fsa_bench [-s scale] [-P slc.profile] [-S sd.profile] [-w cleanup|backup|all] slc_root sd_root
+//        fsa_bench -r trace.json
+// slc_root stands in for /vol/slc (with sys/rights/ticket/apps inside), sd_root for /vol/external01.
+// -r turns a trace.json recorded on the console (trace=true in batch.cfg) into slc.profile and sd.profile.
+// Nothing on slc_root gets modified, the backups go to sd_root/wiiu/tickets/bench and get removed afterwards.
+
+// nftw()
+#define _GNU_SOURCE
+
+#include "host.h"
+#include "fsa_emu.h"
+
+#include <ftw.h>
+#include <getopt.h>
+#include <math.h>
+
+#define TICKET_BUCKET "/vol/slc/sys/rights/ticket/apps"
+#define BENCH_PATH    "/vol/external01/wiiu/tickets/bench"
+
+typedef struct
+{
+    char (*paths)[64];
+    size_t *sizes;
+    size_t count;
+    size_t capacity;
+} FILE_LIST;
+
+typedef struct
+{
+    const FILE_LIST *files;
+    bool sparse;
+    size_t tickets;
+    size_t errors;
+} SCAN;
+
+typedef struct
+{
+    char path[80];
+    uint8_t *data;
+    size_t size;
+} BACKUP_JOB;
+
+// Bounded queue between the SLC reader and the SD writers, like the OSMessageQueue of a backup target
+typedef struct
+{
+    BACKUP_JOB *jobs;
+    size_t depth;
+    size_t head;
+    size_t count;
+    bool done;
+    size_t stalls;
+    size_t errors;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} RING;
+
+static bool addFile(FILE_LIST *list, const char *path, size_t size)
+{
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        char (*paths)[64] = realloc(list->paths, capacity * sizeof(*paths));
+        if(paths == NULL)
+            return false;
+
+        list->paths = paths;
+        size_t *sizes = realloc(list->sizes, capacity * sizeof(size_t));
+        if(sizes == NULL)
+            return false;
+
+        list->sizes = sizes;
+        list->capacity = capacity;
+    }
+
+    snprintf(list->paths[list->count], sizeof(list->paths[0]), "%s", path);
+    list->sizes[list->count++] = size;
+    return true;
+}
+
+// Walks the bucket the way the console does, directory calls included
+static bool listBucket(FILE_LIST *list)
+{
+    EMU_DIR dir;
+    EMU_DIR dir2;
+    EMU_DIR_ENTRY entry;
+    EMU_DIR_ENTRY entry2;
+    char path[64];
+    char file[64];
+    if(emuOpenDir(TICKET_BUCKET, &dir) != EMU_ERROR_OK)
+    {
+        fprintf(stderr, "Can't open %s\n", TICKET_BUCKET);
+        return false;
+    }
+
+    bool ok = true;
+    while(ok && emuReadDir(&dir, &entry))
+    {
+        if(!entry.directory || !isHexName(entry.name, TICKET_BUCKET_NAME))
+            continue;
+
+        snprintf(path, sizeof(path), TICKET_BUCKET "/%.4s", entry.name);
+        if(emuOpenDir(path, &dir2) != EMU_ERROR_OK)
+            continue;
+
+        while(ok && emuReadDir(&dir2, &entry2))
+        {
+            if(entry2.directory || strlen(entry2.name) != TICKET_FILE_NAME)
+                continue;
+
+            snprintf(file, sizeof(file), TICKET_BUCKET "/%.4s/%.12s", entry.name, entry2.name);
+            ok = addFile(list, file, entry2.size);
+        }
+
+        emuCloseDir(&dir2);
+    }
+
+    emuCloseDir(&dir);
+    return ok;
+}
+
+static uint8_t *readWhole(const char *path, size_t size)
+{
+    EMU_FILE file;
+    if(emuOpenFile(path, "r", &file) != EMU_ERROR_OK)
+        return NULL;
+
+    uint8_t *data = malloc(size == 0 ? 1 : size);
+    if(data != NULL && size != 0 && emuReadFile(&file, data, size, 1) != 1)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    emuCloseFile(&file);
+    return data;
+}
+
+// deleteTickets() without the writes: full reads or header reads (sparse=true)
+static void scanFile(size_t job, void *ctx)
+{
+    SCAN *scan = ctx;
+    const char *path = scan->files->paths[job];
+    size_t size = scan->files->sizes[job];
+    size_t tickets = 0;
+    if(scan->sparse)
+    {
+        EMU_FILE file;
+        uint8_t header[sizeof(TICKET)];
+        if(emuOpenFile(path, "r", &file) != EMU_ERROR_OK)
+        {
+            __atomic_add_fetch(&scan->errors, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        for(size_t offset = 0; offset + sizeof(TICKET) <= size; ++tickets)
+        {
+            if(emuReadFileWithPos(&file, header, sizeof(TICKET), 1, offset) != 1)
+            {
+                __atomic_add_fetch(&scan->errors, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            offset += sizeof(TICKET);
+            uint32_t totalHdrSize = TICKET_FIELD(header, total_hdr_size);
+            if(totalHdrSize > 0x14)
+                offset += totalHdrSize - 0x14;
+        }
+
+        emuCloseFile(&file);
+    }
+    else
+    {
+        uint8_t *data = readWhole(path, size);
+        if(data == NULL)
+        {
+            __atomic_add_fetch(&scan->errors, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        for(const uint8_t *ticket = data; ticket != NULL && ticket < data + size; ++tickets)
+            ticket = nextTicket(ticket, data + size);
+
+        free(data);
+    }
+
+    __atomic_add_fetch(&scan->tickets, tickets, __ATOMIC_RELAXED);
+}
+
+static void *backupWriter(void *arg)
+{
+    RING *ring = arg;
+    BACKUP_JOB job;
+    EMU_FILE file;
+    while(true)
+    {
+        pthread_mutex_lock(&ring->lock);
+        while(ring->count == 0 && !ring->done)
+            pthread_cond_wait(&ring->notEmpty, &ring->lock);
+        if(ring->count == 0)
+        {
+            pthread_mutex_unlock(&ring->lock);
+            break;
+        }
+
+        job = ring->jobs[ring->head];
+        ring->head = (ring->head + 1) % ring->depth;
+        --ring->count;
+        pthread_cond_signal(&ring->notFull);
+        pthread_mutex_unlock(&ring->lock);
+
+        if(emuOpenFile(job.path, "w", &file) == EMU_ERROR_OK)
+        {
+            if(emuWriteFile(&file, job.data, job.size, 1) != 1)
+                __atomic_add_fetch(&ring->errors, 1, __ATOMIC_RELAXED);
+
+            emuCloseFile(&file);
+        }
+        else
+            __atomic_add_fetch(&ring->errors, 1, __ATOMIC_RELAXED);
+
+        free(job.data);
+    }
+
+    return NULL;
+}
+
+static void pushJob(RING *ring, BACKUP_JOB *job)
+{
+    pthread_mutex_lock(&ring->lock);
+    if(ring->count == ring->depth)
+    {
+        ++ring->stalls;
+        while(ring->count == ring->depth)
+            pthread_cond_wait(&ring->notFull, &ring->lock);
+    }
+
+    ring->jobs[(ring->head + ring->count) % ring->depth] = *job;
+    ++ring->count;
+    pthread_cond_signal(&ring->notEmpty);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+static void printRun(const char *workload, const char *config, double seconds, const char *extra)
+{
+    printf("%-8s %-22s %9.3f s", workload, config, seconds);
+    for(size_t i = 0; i < emuVolumeCount; ++i)
+        printf("  %s %5.1f%% busy", emuVolumes[i].prefix + 5, seconds > 0.0 ? emuVolumes[i].busy * emuTimeScale * 100.0 / seconds : 0.0);
+
+    printf("  %s\n", extra);
+}
+
+static bool benchCleanup()
+{
+    static const bool sparse[] = { false, true };
+    static const unsigned readers[] = { 1, 2, 4 };
+    char config[32];
+    char extra[64];
+    for(size_t s = 0; s < sizeof(sparse) / sizeof(sparse[0]); ++s)
+    {
+        for(size_t r = 0; r < sizeof(readers) / sizeof(readers[0]); ++r)
+        {
+            FILE_LIST files = { 0 };
+            SCAN scan = { .files = &files, .sparse = sparse[s] };
+            emuResetStats();
+            double start = nowSeconds();
+            if(!listBucket(&files))
+            {
+                free(files.paths);
+                free(files.sizes);
+                return false;
+            }
+
+            runJobs(files.count, readers[r], scanFile, &scan);
+            snprintf(config, sizeof(config), "%s readers=%u", sparse[s] ? "sparse" : "full", readers[r]);
+            snprintf(extra, sizeof(extra), "%zu files, %zu tickets, %zu errors", files.count, scan.tickets, scan.errors);
+            printRun("cleanup", config, nowSeconds() - start, extra);
+            free(files.paths);
+            free(files.sizes);
+        }
+    }
+
+    return true;
+}
+
+static bool runBackup(size_t depth, unsigned writers, size_t *files, size_t *stalls, size_t *errors)
+{
+    RING ring = { .depth = depth };
+    ring.jobs = malloc(sizeof(BACKUP_JOB) * depth);
+    pthread_t *threads = malloc(sizeof(pthread_t) * writers);
+    if(ring.jobs == NULL || threads == NULL)
+    {
+        free(ring.jobs);
+        free(threads);
+        return false;
+    }
+
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.notEmpty, NULL);
+    pthread_cond_init(&ring.notFull, NULL);
+    unsigned started = 0;
+    for(; started < writers; ++started)
+        if(pthread_create(threads + started, NULL, backupWriter, &ring) != 0)
+            break;
+
+    emuMakeDir("/vol/external01/wiiu");
+    emuMakeDir("/vol/external01/wiiu/tickets");
+    emuMakeDir(BENCH_PATH);
+
+    // Same order as backupTickets(): directory calls, then read and queue every file
+    EMU_DIR dir;
+    EMU_DIR dir2;
+    EMU_DIR_ENTRY entry;
+    EMU_DIR_ENTRY entry2;
+    char path[64];
+    BACKUP_JOB job;
+    *files = 0;
+    bool ok = started != 0 && emuOpenDir(TICKET_BUCKET, &dir) == EMU_ERROR_OK;
+    if(ok)
+    {
+        while(emuReadDir(&dir, &entry))
+        {
+            if(!entry.directory || !isHexName(entry.name, TICKET_BUCKET_NAME))
+                continue;
+
+            snprintf(path, sizeof(path), TICKET_BUCKET "/%.4s", entry.name);
+            if(emuOpenDir(path, &dir2) != EMU_ERROR_OK)
+                continue;
+
+            snprintf(job.path, sizeof(job.path), BENCH_PATH "/%.4s", entry.name);
+            emuMakeDir(job.path);
+            while(emuReadDir(&dir2, &entry2))
+            {
+                if(entry2.directory || strlen(entry2.name) != TICKET_FILE_NAME)
+                    continue;
+
+                snprintf(path, sizeof(path), TICKET_BUCKET "/%.4s/%.12s", entry.name, entry2.name);
+                job.data = readWhole(path, entry2.size);
+                if(job.data == NULL)
+                {
+                    ++ring.errors;
+                    continue;
+                }
+
+                job.size = entry2.size;
+                snprintf(job.path, sizeof(job.path), BENCH_PATH "/%.4s/%.12s", entry.name, entry2.name);
+                pushJob(&ring, &job);
+                ++*files;
+            }
+
+            emuCloseDir(&dir2);
+        }
+
+        emuCloseDir(&dir);
+    }
+
+    pthread_mutex_lock(&ring.lock);
+    ring.done = true;
+    pthread_cond_broadcast(&ring.notEmpty);
+    pthread_mutex_unlock(&ring.lock);
+    for(unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    *stalls = ring.stalls;
+    *errors = ring.errors;
+    pthread_cond_destroy(&ring.notFull);
+    pthread_cond_destroy(&ring.notEmpty);
+    pthread_mutex_destroy(&ring.lock);
+    free(ring.jobs);
+    free(threads);
+    return ok;
+}
+
+static bool benchBackup()
+{
+    static const size_t depths[] = { 1, 4, 16, 64, 256 };
+    static const unsigned writers[] = { 1, 2 };
+    char local[PATH_MAX];
+    char config[32];
+    char extra[64];
+    size_t files;
+    size_t stalls;
+    size_t errors;
+    emuResolve(BENCH_PATH, local);
+    for(size_t w = 0; w < sizeof(writers) / sizeof(writers[0]); ++w)
+    {
+        for(size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d)
+        {
+            nftw(local, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+            emuResetStats();
+            double start = nowSeconds();
+            if(!runBackup(depths[d], writers[w], &files, &stalls, &errors))
+            {
+                fprintf(stderr, "Backup run failed\n");
+                return false;
+            }
+
+            double seconds = nowSeconds() - start;
+            snprintf(config, sizeof(config), "depth=%zu writers=%u", depths[d], writers[w]);
+            snprintf(extra, sizeof(extra), "%zu files, %zu stalls, %zu errors", files, stalls, errors);
+            printRun("backup", config, seconds, extra);
+        }
+    }
+
+    nftw(local, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return true;
+}
+
+typedef struct
+{
+    double n;
+    double bytes;
+    double dur;
+    double bytes2;
+    double bytesDur;
+} SAMPLES;
+
+// Maps the names trace.c writes to our ops
+static int traceOp(const char *name)
+{
+    static const char *const names[] = { "FSAOpenFileEx", "FSAOpenDir", "FSAReadFile", "FSAWriteFile", "FSARemove", "FSAReadDir" };
+    static const EMU_OP ops[] = { EMU_OP_OPEN, EMU_OP_OPEN_DIR, EMU_OP_READ, EMU_OP_WRITE, EMU_OP_REMOVE, EMU_OP_READ_DIR };
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if(strcmp(name, names[i]) == 0)
+            return ops[i];
+
+    return -1;
+}
+
+static bool jsonString(const char *line, const char *key, char *out, size_t size)
+{
+    const char *start = strstr(line, key);
+    if(start == NULL)
+        return false;
+
+    start += strlen(key);
+    const char *end = strchr(start, '"');
+    if(end == NULL || (size_t)(end - start) >= size)
+        return false;
+
+    memcpy(out, start, end - start);
+    out[end - start] = '\0';
+    return true;
+}
+
+static bool jsonNumber(const char *line, const char *key, double *out)
+{
+    const char *start = strstr(line, key);
+    return start != NULL && sscanf(start + strlen(key), "%lf", out) == 1;
+}
+
+// Fits duration = latency + bytes / bandwidth per op and volume. Ops without samples keep the defaults.
+static void fitProfile(SAMPLES *samples, EMU_PROFILE *profile)
+{
+    double mean;
+    double meanBytes;
+    double var;
+    double slope;
+    for(size_t op = 0; op < EMU_OP_COUNT; ++op)
+    {
+        if(samples[op].n == 0)
+            continue;
+
+        mean = samples[op].dur / samples[op].n;
+        meanBytes = samples[op].bytes / samples[op].n;
+        var = samples[op].bytes2 / samples[op].n - meanBytes * meanBytes;
+        slope = var > 1.0 ? (samples[op].bytesDur / samples[op].n - meanBytes * mean) / var : 0.0;
+        if((op == EMU_OP_READ || op == EMU_OP_WRITE) && slope > 0.0)
+        {
+            profile->latency[op] = fmax(mean - slope * meanBytes, 0.0) / 1000000.0;
+            if(op == EMU_OP_READ)
+                profile->readBandwidth = 1000000.0 / slope;
+            else
+                profile->writeBandwidth = 1000000.0 / slope;
+        }
+        else
+            profile->latency[op] = mean / 1000000.0;
+    }
+}
+
+static bool recordProfiles(const char *tracePath)
+{
+    FILE *f = fopen(tracePath, "r");
+    if(f == NULL)
+    {
+        fprintf(stderr, "Can't open %s\n", tracePath);
+        return false;
+    }
+
+    static const char *const prefixes[] = { "/vol/slc/", "/vol/external01/" };
+    static const char *const outputs[] = { "slc.profile", "sd.profile" };
+    SAMPLES samples[2][EMU_OP_COUNT] = { 0 };
+    char line[512];
+    char name[32];
+    char path[128];
+    double dur;
+    double bytes;
+    int op;
+    size_t events = 0;
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(!jsonString(line, "\"name\":\"", name, sizeof(name)) || (op = traceOp(name)) < 0)
+            continue;
+        if(!jsonString(line, "\"path\":\"", path, sizeof(path)) || !jsonNumber(line, "\"dur\":", &dur))
+            continue;
+        if(!jsonNumber(line, "\"bytes\":", &bytes))
+            bytes = 0.0;
+
+        for(size_t v = 0; v < 2; ++v)
+        {
+            if(strncmp(path, prefixes[v], strlen(prefixes[v])) != 0)
+                continue;
+
+            SAMPLES *s = samples[v] + op;
+            s->n += 1.0;
+            s->bytes += bytes;
+            s->dur += dur;
+            s->bytes2 += bytes * bytes;
+            s->bytesDur += bytes * dur;
+            ++events;
+        }
+    }
+
+    fclose(f);
+    printf("%zu events used\n", events);
+    for(size_t v = 0; v < 2; ++v)
+    {
+        EMU_PROFILE profile = v == 0 ? emuDefaultSLC : emuDefaultSD;
+        fitProfile(samples[v], &profile);
+        FILE *out = fopen(outputs[v], "w");
+        if(out == NULL)
+        {
+            fprintf(stderr, "Can't write %s\n", outputs[v]);
+            return false;
+        }
+
+        fprintf(out, "# Recorded from %s, latencies in microseconds\n", tracePath);
+        emuWriteProfile(out, &profile);
+        fclose(out);
+        printf("%s written\n", outputs[v]);
+    }
+
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s scale] [-P slc.profile] [-S sd.profile] [-w cleanup|backup|all] slc_root sd_root\n", name);
+    fprintf(stderr, "       %s -r trace.json\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    EMU_PROFILE slc = emuDefaultSLC;
+    EMU_PROFILE sd = emuDefaultSD;
+    const char *workload = "all";
+    int opt;
+    while((opt = getopt(argc, argv, "s:P:S:w:r:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                emuTimeScale = atof(optarg);
+                if(emuTimeScale <= 0.0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if(!emuLoadProfile(optarg, &slc))
+                {
+                    fprintf(stderr, "Can't load %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                if(!emuLoadProfile(optarg, &sd))
+                {
+                    fprintf(stderr, "Can't load %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                workload = optarg;
+                break;
+            case 'r':
+                return recordProfiles(optarg) ? 0 : 1;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(argc - optind != 2 || (strcmp(workload, "all") != 0 && strcmp(workload, "cleanup") != 0 && strcmp(workload, "backup") != 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    emuMount("/vol/slc", argv[optind], &slc);
+    emuMount("/vol/external01", argv[optind + 1], &sd);
+    printf("Time scale %.3f, busy shares are in emulated time\n", emuTimeScale);
+
+    bool ok = true;
+    if(strcmp(workload, "backup") != 0)
+        ok = benchCleanup();
+    if(ok && strcmp(workload, "cleanup") != 0)
+        ok = benchBackup();
+
+    return ok ? 0 : 1;
+}
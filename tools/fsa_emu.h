@@ -0,0 +1,363 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// A stand-in for the FSA calls the console code uses, backed by local directories. Every call costs a configurable
+// latency plus size / bandwidth, and each volume serves one request at a time like the real devices do. That way
+// thread counts and queue depths can be tuned on a PC with timings close to the SLC and the SD card.
+
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EMU_MAX_VOLUMES 4
+#define EMU_ERROR_OK    0
+
+typedef enum
+{
+    EMU_OP_OPEN,
+    EMU_OP_OPEN_DIR,
+    EMU_OP_READ,
+    EMU_OP_WRITE,
+    EMU_OP_REMOVE,
+    EMU_OP_READ_DIR,
+    EMU_OP_CLOSE,
+    EMU_OP_MAKE_DIR,
+    EMU_OP_COUNT,
+} EMU_OP;
+
+static const char *const emuOpNames[EMU_OP_COUNT] = {
+    "open",
+    "open_dir",
+    "read",
+    "write",
+    "remove",
+    "read_dir",
+    "close",
+    "make_dir",
+};
+
+typedef struct
+{
+    double latency[EMU_OP_COUNT]; // Seconds per call
+    double readBandwidth;         // Bytes per second, 0 = unlimited
+    double writeBandwidth;
+} EMU_PROFILE;
+
+typedef struct
+{
+    char prefix[32]; // "/vol/slc"
+    char root[PATH_MAX];
+    EMU_PROFILE profile;
+    pthread_mutex_t lock;
+    uint64_t calls[EMU_OP_COUNT];
+    uint64_t bytes[EMU_OP_COUNT];
+    double busy; // Seconds the device spent serving requests
+} EMU_VOLUME;
+
+typedef struct
+{
+    int fd;
+    EMU_VOLUME *volume;
+} EMU_FILE;
+
+typedef struct
+{
+    DIR *dir;
+    EMU_VOLUME *volume;
+    char path[PATH_MAX];
+} EMU_DIR;
+
+typedef struct
+{
+    char name[256];
+    bool directory;
+    size_t size;
+} EMU_DIR_ENTRY;
+
+static EMU_VOLUME emuVolumes[EMU_MAX_VOLUMES];
+static size_t emuVolumeCount = 0;
+static double emuTimeScale = 1.0; // < 1 speeds up sweeps, the relation between the configurations stays the same
+
+// Rough numbers for an unknown console, record real ones with fsa_bench -r
+static const EMU_PROFILE emuDefaultSLC = {
+    .latency = { 0.0015, 0.0010, 0.0004, 0.0010, 0.0030, 0.0002, 0.0003, 0.0030 },
+    .readBandwidth = 12.0 * 1024 * 1024,
+    .writeBandwidth = 3.0 * 1024 * 1024,
+};
+
+static const EMU_PROFILE emuDefaultSD = {
+    .latency = { 0.0040, 0.0030, 0.0008, 0.0020, 0.0060, 0.0005, 0.0020, 0.0080 },
+    .readBandwidth = 8.0 * 1024 * 1024,
+    .writeBandwidth = 4.0 * 1024 * 1024,
+};
+
+static inline EMU_VOLUME *emuMount(const char *prefix, const char *root, const EMU_PROFILE *profile)
+{
+    if(emuVolumeCount == EMU_MAX_VOLUMES || strlen(prefix) >= sizeof(emuVolumes[0].prefix) || strlen(root) >= PATH_MAX)
+        return NULL;
+
+    EMU_VOLUME *volume = emuVolumes + emuVolumeCount++;
+    memset(volume, 0, sizeof(EMU_VOLUME));
+    strcpy(volume->prefix, prefix);
+    strcpy(volume->root, root);
+    volume->profile = *profile;
+    pthread_mutex_init(&volume->lock, NULL);
+    return volume;
+}
+
+static inline void emuResetStats()
+{
+    for(size_t i = 0; i < emuVolumeCount; ++i)
+    {
+        memset(emuVolumes[i].calls, 0, sizeof(emuVolumes[i].calls));
+        memset(emuVolumes[i].bytes, 0, sizeof(emuVolumes[i].bytes));
+        emuVolumes[i].busy = 0.0;
+    }
+}
+
+// Translates a console path into the local one. Returns NULL for paths outside of all volumes.
+static inline EMU_VOLUME *emuResolve(const char *path, char *out)
+{
+    size_t len;
+    for(size_t i = 0; i < emuVolumeCount; ++i)
+    {
+        len = strlen(emuVolumes[i].prefix);
+        if(strncmp(path, emuVolumes[i].prefix, len) == 0 && (path[len] == '/' || path[len] == '\0'))
+        {
+            if(snprintf(out, PATH_MAX, "%s%s", emuVolumes[i].root, path + len) >= PATH_MAX)
+                return NULL;
+
+            return emuVolumes + i;
+        }
+    }
+
+    return NULL;
+}
+
+static inline void emuSleep(double seconds)
+{
+    seconds *= emuTimeScale;
+    if(seconds <= 0.0)
+        return;
+
+    struct timespec ts = { .tv_sec = (time_t)seconds, .tv_nsec = (long)((seconds - (time_t)seconds) * 1000000000.0) };
+    while(nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+// Every call holds the device for latency + transfer time, concurrent callers queue up behind it
+static inline void emuCharge(EMU_VOLUME *volume, EMU_OP op, size_t bytes)
+{
+    double cost = volume->profile.latency[op];
+    if(op == EMU_OP_READ && volume->profile.readBandwidth > 0.0)
+        cost += bytes / volume->profile.readBandwidth;
+    else if(op == EMU_OP_WRITE && volume->profile.writeBandwidth > 0.0)
+        cost += bytes / volume->profile.writeBandwidth;
+
+    pthread_mutex_lock(&volume->lock);
+    emuSleep(cost);
+    ++volume->calls[op];
+    volume->bytes[op] += bytes;
+    volume->busy += cost;
+    pthread_mutex_unlock(&volume->lock);
+}
+
+static inline int emuOpenFile(const char *path, const char *mode, EMU_FILE *file)
+{
+    char local[PATH_MAX];
+    file->volume = emuResolve(path, local);
+    if(file->volume == NULL)
+        return -ENOENT;
+
+    int flags = mode[0] == 'r' ? O_RDONLY : mode[0] == 'a' ? O_WRONLY | O_CREAT | O_APPEND : O_WRONLY | O_CREAT | O_TRUNC;
+    file->fd = open(local, flags, 0660);
+    int ret = file->fd < 0 ? -errno : EMU_ERROR_OK;
+    emuCharge(file->volume, EMU_OP_OPEN, 0);
+    return ret;
+}
+
+// Like FSAReadFileWithPos(): returns count on success
+static inline int emuReadFileWithPos(EMU_FILE *file, void *buffer, size_t size, size_t count, size_t pos)
+{
+    ssize_t ret = pread(file->fd, buffer, size * count, pos);
+    int err = errno;
+    emuCharge(file->volume, EMU_OP_READ, ret < 0 ? 0 : (size_t)ret);
+    if(ret < 0)
+        return -err;
+
+    return (size_t)ret == size * count ? (int)count : (int)(ret / size);
+}
+
+static inline int emuReadFile(EMU_FILE *file, void *buffer, size_t size, size_t count)
+{
+    ssize_t ret = read(file->fd, buffer, size * count);
+    int err = errno;
+    emuCharge(file->volume, EMU_OP_READ, ret < 0 ? 0 : (size_t)ret);
+    if(ret < 0)
+        return -err;
+
+    return (size_t)ret == size * count ? (int)count : (int)(ret / size);
+}
+
+static inline int emuWriteFile(EMU_FILE *file, const void *buffer, size_t size, size_t count)
+{
+    ssize_t ret = write(file->fd, buffer, size * count);
+    int err = errno;
+    emuCharge(file->volume, EMU_OP_WRITE, ret < 0 ? 0 : (size_t)ret);
+    if(ret < 0)
+        return -err;
+
+    return (size_t)ret == size * count ? (int)count : (int)(ret / size);
+}
+
+static inline int emuCloseFile(EMU_FILE *file)
+{
+    int ret = close(file->fd) == 0 ? EMU_ERROR_OK : -errno;
+    emuCharge(file->volume, EMU_OP_CLOSE, 0);
+    return ret;
+}
+
+static inline int emuRemove(const char *path)
+{
+    char local[PATH_MAX];
+    EMU_VOLUME *volume = emuResolve(path, local);
+    if(volume == NULL)
+        return -ENOENT;
+
+    int ret = remove(local) == 0 ? EMU_ERROR_OK : -errno;
+    emuCharge(volume, EMU_OP_REMOVE, 0);
+    return ret;
+}
+
+static inline int emuMakeDir(const char *path)
+{
+    char local[PATH_MAX];
+    EMU_VOLUME *volume = emuResolve(path, local);
+    if(volume == NULL)
+        return -ENOENT;
+
+    int ret = mkdir(local, 0770) == 0 ? EMU_ERROR_OK : -errno;
+    emuCharge(volume, EMU_OP_MAKE_DIR, 0);
+    return ret;
+}
+
+static inline int emuOpenDir(const char *path, EMU_DIR *dir)
+{
+    dir->volume = emuResolve(path, dir->path);
+    if(dir->volume == NULL)
+        return -ENOENT;
+
+    dir->dir = opendir(dir->path);
+    int ret = dir->dir == NULL ? -errno : EMU_ERROR_OK;
+    emuCharge(dir->volume, EMU_OP_OPEN_DIR, 0);
+    return ret;
+}
+
+// Returns false at the end of the directory. Like FSAReadDir() the entry includes the stat info.
+static inline bool emuReadDir(EMU_DIR *dir, EMU_DIR_ENTRY *entry)
+{
+    struct dirent *de;
+    struct stat st;
+    char local[PATH_MAX];
+    emuCharge(dir->volume, EMU_OP_READ_DIR, 0);
+    while((de = readdir(dir->dir)) != NULL)
+    {
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 || strlen(de->d_name) >= sizeof(entry->name))
+            continue;
+        if(snprintf(local, PATH_MAX, "%s/%s", dir->path, de->d_name) >= PATH_MAX || stat(local, &st) != 0)
+            continue;
+
+        strcpy(entry->name, de->d_name);
+        entry->directory = S_ISDIR(st.st_mode);
+        entry->size = st.st_size;
+        return true;
+    }
+
+    return false;
+}
+
+static inline void emuCloseDir(EMU_DIR *dir)
+{
+    closedir(dir->dir);
+    emuCharge(dir->volume, EMU_OP_CLOSE, 0);
+}
+
+// Profile files have one "<op> <microseconds>" or "read_mbps|write_mbps <MB/s>" line per setting, # starts a comment.
+// Settings not in the file keep their current value.
+static inline bool emuLoadProfile(const char *path, EMU_PROFILE *profile)
+{
+    FILE *f = fopen(path, "r");
+    if(f == NULL)
+        return false;
+
+    char line[256];
+    char key[32];
+    double value;
+    size_t op;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), f) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        if(comment != NULL)
+            *comment = '\0';
+        if(sscanf(line, "%31s %lf", key, &value) != 2)
+            continue;
+
+        if(strcmp(key, "read_mbps") == 0)
+            profile->readBandwidth = value * 1024 * 1024;
+        else if(strcmp(key, "write_mbps") == 0)
+            profile->writeBandwidth = value * 1024 * 1024;
+        else
+        {
+            for(op = 0; op < EMU_OP_COUNT; ++op)
+                if(strcmp(key, emuOpNames[op]) == 0)
+                    break;
+
+            if(op == EMU_OP_COUNT)
+            {
+                fprintf(stderr, "%s: unknown setting %s\n", path, key);
+                ok = false;
+            }
+            else
+                profile->latency[op] = value / 1000000.0;
+        }
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static inline void emuWriteProfile(FILE *out, const EMU_PROFILE *profile)
+{
+    for(size_t op = 0; op < EMU_OP_COUNT; ++op)
+        fprintf(out, "%-10s %.0f\n", emuOpNames[op], profile->latency[op] * 1000000.0);
+
+    fprintf(out, "read_mbps  %.2f\n", profile->readBandwidth / (1024 * 1024));
+    fprintf(out, "write_mbps %.2f\n", profile->writeBandwidth / (1024 * 1024));
+}
@@ -0,0 +1,189 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Shared helpers for the native (Linux) tools working on copies of the ticket bucket.
+
+#pragma once
+
+#include <ticket.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define isDLC(tid)           (((uint32_t)(tid >> 32)) == 0x0005000C)
+#define TICKET_FIELD(t, f)   readBE(((const uint8_t *)(t)) + offsetof(TICKET, f), sizeof(((TICKET *)0)->f))
+#define TICKET_BUCKET_NAME   4  // strlen("0000")
+#define TICKET_FILE_NAME     12 // strlen("00000000.tik")
+
+// Tickets are stored big endian, just like the Wii U likes it
+static inline uint64_t readBE(const uint8_t *ptr, size_t size)
+{
+    uint64_t ret = 0;
+    for(size_t i = 0; i < size; ++i)
+        ret = (ret << 8) | ptr[i];
+
+    return ret;
+}
+
+static inline void writeBE(uint8_t *ptr, uint64_t value, size_t size)
+{
+    while(size--)
+    {
+        ptr[size] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+// Same math as the console code: the header is followed by total_hdr_size - 0x14 bytes of section headers.
+// Returns NULL if the ticket doesn't fit into the remaining buffer.
+static inline const uint8_t *nextTicket(const uint8_t *ticket, const uint8_t *end)
+{
+    if(end - ticket < (ptrdiff_t)sizeof(TICKET))
+        return NULL;
+
+    const uint8_t *ptr = ticket + sizeof(TICKET);
+    uint32_t totalHdrSize = TICKET_FIELD(ticket, total_hdr_size);
+    if(totalHdrSize > 0x14)
+        ptr += totalHdrSize - 0x14;
+
+    return ptr > end ? NULL : ptr;
+}
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+} MAPPED_FILE;
+
+static inline bool mapFile(const char *path, MAPPED_FILE *file)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    file->size = st.st_size;
+    if(file->size == 0)
+    {
+        // mmap() refuses empty mappings
+        file->data = NULL;
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    madvise(data, file->size, MADV_SEQUENTIAL);
+    file->data = data;
+    return true;
+}
+
+static inline void unmapFile(MAPPED_FILE *file)
+{
+    if(file->data != NULL)
+        munmap((void *)file->data, file->size);
+}
+
+static inline bool isHexName(const char *name, size_t len)
+{
+    for(size_t i = 0; i < len; ++i)
+    {
+        char c = name[i];
+        if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')))
+            return false;
+    }
+
+    return name[len] == '\0';
+}
+
+static inline double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// A very small thread pool: every worker pulls the next job index until all count jobs are done.
+typedef void (*JOB_FUNCTION)(size_t job, void *ctx);
+
+typedef struct
+{
+    JOB_FUNCTION fn;
+    void *ctx;
+    size_t count;
+    size_t next;
+} JOB_QUEUE;
+
+static inline void *jobWorker(void *arg)
+{
+    JOB_QUEUE *queue = arg;
+    size_t job;
+    while((job = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count)
+        queue->fn(job, queue->ctx);
+
+    return NULL;
+}
+
+static inline unsigned defaultThreads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (unsigned)n;
+}
+
+static inline void runJobs(size_t count, unsigned threads, JOB_FUNCTION fn, void *ctx)
+{
+    JOB_QUEUE queue = { .fn = fn, .ctx = ctx, .count = count, .next = 0 };
+    if(threads > count)
+        threads = count;
+    if(threads <= 1)
+    {
+        jobWorker(&queue);
+        return;
+    }
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    unsigned started = 0;
+    if(workers != NULL)
+        for(; started < threads; ++started)
+            if(pthread_create(workers + started, NULL, jobWorker, &queue) != 0)
+                break;
+
+    // Whatever couldn't be started gets done by us
+    jobWorker(&queue);
+    for(unsigned i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+}
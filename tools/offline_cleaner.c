@@ -0,0 +1,740 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+
+// Native tool applying the rules of deleteTickets() and cleanTitleList() to an extracted copy of the SLC.
+// Usage: offline_cleaner [-n] [-d] [-s] [-j threads] -i installed -b ticket/apps [-l title.list]
+// installed lists the installed titles, either as text (one hex TID per line) or as big endian uint64_t like title.list.
+// -d and -s are the dlcdedupe = 1 and select = best batch.cfg options.
+// The console walks the bucket in FSAReadDir() order, we use the sorted order of the names instead.
+// Which ticket of a duplicated TID (or of identical DLC tickets) survives depends on that order, everything else is
+// byte identical.
+
+#include "host.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+    uint64_t tid;
+    uint64_t ticketId;
+    uint16_t version;
+    bool keep;
+} TICKET_ENTRY;
+
+typedef struct
+{
+    char *path;
+    MAPPED_FILE file;
+    TICKET_ENTRY *tickets;
+    size_t count;
+    size_t removed;
+    bool failed;
+} TICKET_FILE;
+
+typedef struct
+{
+    char *path;
+    TICKET_FILE *files;
+    size_t count;
+} BUCKET;
+
+typedef struct
+{
+    BUCKET *buckets;
+    size_t count;
+    uint64_t *installed;
+    size_t installedCount;
+    bool dryRun;
+    bool dlcDedupe;
+    bool selectBest;
+    size_t errors;
+} CLEANER;
+
+// A ticket still kept after the MCP check, order is its position in the walk
+typedef struct
+{
+    TICKET_ENTRY *ticket;
+    const uint8_t *data;
+    size_t order;
+} CANDIDATE;
+
+// Open addressing set for the TIDs already seen, 0 marks a free slot (and gets tracked on its own)
+typedef struct
+{
+    uint64_t *slots;
+    size_t mask;
+    size_t count;
+    bool hasZero;
+} TID_SET;
+
+static bool tidSetInit(TID_SET *set, size_t expected)
+{
+    size_t size = 64;
+    while(size < expected * 2)
+        size <<= 1;
+
+    set->slots = calloc(size, sizeof(uint64_t));
+    set->mask = size - 1;
+    set->count = 0;
+    set->hasZero = false;
+    return set->slots != NULL;
+}
+
+// Returns false if tid was in the set already
+static bool tidSetAdd(TID_SET *set, uint64_t tid)
+{
+    if(tid == 0)
+    {
+        bool ret = !set->hasZero;
+        set->hasZero = true;
+        return ret;
+    }
+
+    size_t i = (size_t)((tid * 0x9E3779B97F4A7C15ULL) >> 32) & set->mask;
+    while(set->slots[i] != 0)
+    {
+        if(set->slots[i] == tid)
+            return false;
+
+        i = (i + 1) & set->mask;
+    }
+
+    set->slots[i] = tid;
+    ++set->count;
+    return true;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t ua = *(const uint64_t *)a;
+    uint64_t ub = *(const uint64_t *)b;
+    return ua == ub ? 0 : (ua < ub ? -1 : 1);
+}
+
+static int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool isInstalled(const CLEANER *cleaner, uint64_t tid)
+{
+    return bsearch(&tid, cleaner->installed, cleaner->installedCount, sizeof(uint64_t), compareU64) != NULL;
+}
+
+// Same as the console code
+static bool isSystemTitle(uint64_t tid)
+{
+    uint32_t th = (uint32_t)(tid >> 32);
+    switch(th)
+    {
+        case 0x00050010:
+        case 0x0005001B:
+        case 0x00050030:
+            return true;
+    }
+
+    return false;
+}
+
+static bool readInstalled(CLEANER *cleaner, const char *path)
+{
+    MAPPED_FILE file;
+    if(!mapFile(path, &file))
+    {
+        fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    bool text = true;
+    for(size_t i = 0; i < file.size && text; ++i)
+        if(file.data[i] != '\n' && file.data[i] != '\r' && file.data[i] != '\t' && (file.data[i] < ' ' || file.data[i] > '~'))
+            text = false;
+
+    // Text needs at least 17 bytes per TID, binary 8
+    cleaner->installed = malloc(sizeof(uint64_t) * (file.size / 8 + 1));
+    if(cleaner->installed == NULL)
+    {
+        unmapFile(&file);
+        return false;
+    }
+
+    cleaner->installedCount = 0;
+    if(text)
+    {
+        uint64_t tid = 0;
+        int digits = 0;
+        bool comment = false;
+        char c;
+        for(size_t i = 0; i <= file.size; ++i)
+        {
+            c = i == file.size ? '\n' : file.data[i];
+            if(c == '\n')
+            {
+                if(digits != 0)
+                    cleaner->installed[cleaner->installedCount++] = tid;
+
+                tid = 0;
+                digits = 0;
+                comment = false;
+            }
+            else if(comment || c == '-' || c == ' ' || c == '\t' || c == '\r')
+                continue;
+            else if(c == '#')
+                comment = true;
+            else if(c == 'x' && digits == 1 && tid == 0)
+                digits = 0; // 0x prefix
+            else
+            {
+                int value = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : (c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1));
+                if(value < 0 || ++digits > 16)
+                {
+                    fprintf(stderr, "Invalid TID in %s\n", path);
+                    unmapFile(&file);
+                    return false;
+                }
+
+                tid = (tid << 4) | value;
+            }
+        }
+    }
+    else
+        for(size_t i = 0; i + sizeof(uint64_t) <= file.size; i += sizeof(uint64_t))
+            cleaner->installed[cleaner->installedCount++] = readBE(file.data + i, sizeof(uint64_t));
+
+    unmapFile(&file);
+    qsort(cleaner->installed, cleaner->installedCount, sizeof(uint64_t), compareU64);
+    return true;
+}
+
+static void freeNames(char **names, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        free(names[i]);
+
+    free(names);
+}
+
+// An empty directory gives *names == NULL and true, errors get reported and give false
+static bool listDir(const char *path, bool dirs, size_t nameLen, char ***names, size_t *count)
+{
+    *names = NULL;
+    *count = 0;
+    DIR *dir = opendir(path);
+    if(dir == NULL)
+    {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t capacity = 0;
+    char sub[PATH_MAX];
+    struct stat st;
+    struct dirent *entry;
+    bool ok = true;
+    while(ok && (entry = readdir(dir)) != NULL)
+    {
+        // Same filter as the console code
+        if(entry->d_name[0] == '.' || strlen(entry->d_name) != nameLen)
+            continue;
+
+        snprintf(sub, PATH_MAX, "%s/%s", path, entry->d_name);
+        if(stat(sub, &st) != 0 || (S_ISDIR(st.st_mode) != dirs))
+            continue;
+
+        if(*count == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            char **tmp = realloc(*names, sizeof(char *) * capacity);
+            if(tmp == NULL)
+            {
+                ok = false;
+                break;
+            }
+
+            *names = tmp;
+        }
+
+        (*names)[*count] = strdup(sub);
+        if((*names)[*count] == NULL)
+            ok = false;
+        else
+            ++*count;
+    }
+
+    closedir(dir);
+    if(!ok)
+    {
+        fprintf(stderr, "EOM while listing %s!\n", path);
+        freeNames(*names, *count);
+        *names = NULL;
+        *count = 0;
+        return false;
+    }
+
+    if(*names != NULL)
+        qsort(*names, *count, sizeof(char *), compareNames);
+
+    return true;
+}
+
+// Phase 1 (parallel): map and split every file of a bucket
+static void scanBucket(size_t job, void *ctx)
+{
+    CLEANER *cleaner = ctx;
+    BUCKET *bucket = cleaner->buckets + job;
+    size_t count;
+    char **names;
+    if(!listDir(bucket->path, false, TICKET_FILE_NAME, &names, &count))
+    {
+        __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if(count == 0)
+        return;
+
+    bucket->files = calloc(count, sizeof(TICKET_FILE));
+    if(bucket->files == NULL)
+    {
+        freeNames(names, count);
+        __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    bucket->count = count;
+    TICKET_FILE *file;
+    size_t capacity;
+    const uint8_t *end;
+    const uint8_t *ptr;
+    for(size_t i = 0; i < count; ++i)
+    {
+        file = bucket->files + i;
+        file->path = names[i];
+        if(!mapFile(file->path, &file->file))
+        {
+            fprintf(stderr, "Error reading %s: %s\n", file->path, strerror(errno));
+            file->failed = true;
+            __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // The console refuses files without a ticket, too
+        if(file->file.size == 0)
+        {
+            fprintf(stderr, "Filesize missmatch at %s!\n", file->path);
+            file->failed = true;
+            __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        capacity = file->file.size / sizeof(TICKET) + 1;
+        file->tickets = malloc(sizeof(TICKET_ENTRY) * capacity);
+        if(file->tickets == NULL)
+        {
+            file->failed = true;
+            __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        end = file->file.data + file->file.size;
+        for(const uint8_t *ticket = file->file.data; ticket != end; ticket = ptr)
+        {
+            ptr = nextTicket(ticket, end);
+            if(ptr == NULL)
+            {
+                fprintf(stderr, "Filesize missmatch at %s!\n", file->path);
+                file->failed = true;
+                __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            file->tickets[file->count].offset = ticket - file->file.data;
+            file->tickets[file->count].size = ptr - ticket;
+            file->tickets[file->count].tid = TICKET_FIELD(ticket, tid);
+            file->tickets[file->count].ticketId = TICKET_FIELD(ticket, ticket_id);
+            file->tickets[file->count].version = TICKET_FIELD(ticket, title_version);
+            file->tickets[file->count].keep = isInstalled(cleaner, file->tickets[file->count].tid);
+            ++file->count;
+        }
+    }
+
+    free(names);
+}
+
+static CANDIDATE *collectCandidates(CLEANER *cleaner, bool dlc, size_t total, size_t *count)
+{
+    CANDIDATE *candidates = malloc(sizeof(CANDIDATE) * (total + 1));
+    if(candidates == NULL)
+        return NULL;
+
+    *count = 0;
+    TICKET_FILE *file;
+    for(size_t i = 0; i < cleaner->count; ++i)
+    {
+        for(size_t j = 0; j < cleaner->buckets[i].count; ++j)
+        {
+            file = cleaner->buckets[i].files + j;
+            for(size_t k = 0; k < file->count; ++k)
+            {
+                if(!file->tickets[k].keep || isDLC(file->tickets[k].tid) != dlc)
+                    continue;
+
+                candidates[*count].ticket = file->tickets + k;
+                candidates[*count].data = file->file.data + file->tickets[k].offset;
+                candidates[*count].order = *count;
+                ++*count;
+            }
+        }
+    }
+
+    return candidates;
+}
+
+// Same TIDs next to each other, the one select=best keeps (highest title version, then ticket ID, then first seen) first
+static int compareBest(const void *a, const void *b)
+{
+    const CANDIDATE *x = a;
+    const CANDIDATE *y = b;
+    if(x->ticket->tid != y->ticket->tid)
+        return x->ticket->tid < y->ticket->tid ? -1 : 1;
+    if(x->ticket->version != y->ticket->version)
+        return x->ticket->version > y->ticket->version ? -1 : 1;
+    if(x->ticket->ticketId != y->ticket->ticketId)
+        return x->ticket->ticketId > y->ticket->ticketId ? -1 : 1;
+
+    return x->order < y->order ? -1 : 1;
+}
+
+static int compareContents(const CANDIDATE *x, const CANDIDATE *y)
+{
+    if(x->ticket->size != y->ticket->size)
+        return x->ticket->size < y->ticket->size ? -1 : 1;
+
+    return memcmp(x->data, y->data, x->ticket->size);
+}
+
+// Byte identical tickets next to each other, the first seen first
+static int compareDLC(const void *a, const void *b)
+{
+    const CANDIDATE *x = a;
+    const CANDIDATE *y = b;
+    int ret = compareContents(x, y);
+    if(ret != 0)
+        return ret;
+
+    return x->order < y->order ? -1 : 1;
+}
+
+// select = best: only the newest ticket of a TID survives
+static bool selectBestTickets(CLEANER *cleaner, size_t total)
+{
+    size_t count;
+    CANDIDATE *candidates = collectCandidates(cleaner, false, total, &count);
+    if(candidates == NULL)
+        return false;
+
+    qsort(candidates, count, sizeof(CANDIDATE), compareBest);
+    for(size_t i = 1; i < count; ++i)
+        if(candidates[i].ticket->tid == candidates[i - 1].ticket->tid)
+            candidates[i].ticket->keep = false;
+
+    free(candidates);
+    return true;
+}
+
+// dlcdedupe = 1: DLC tickets sharing a TID are fine, byte identical copies are not
+static bool dedupeDLC(CLEANER *cleaner, size_t total, size_t *duplicates)
+{
+    size_t count;
+    CANDIDATE *candidates = collectCandidates(cleaner, true, total, &count);
+    if(candidates == NULL)
+        return false;
+
+    qsort(candidates, count, sizeof(CANDIDATE), compareDLC);
+    *duplicates = 0;
+    for(size_t i = 1; i < count; ++i)
+    {
+        if(compareContents(candidates + i, candidates + i - 1) == 0)
+        {
+            candidates[i].ticket->keep = false;
+            ++*duplicates;
+        }
+    }
+
+    free(candidates);
+    return true;
+}
+
+// Phase 3 (parallel): rewrite or remove the files of a bucket
+static void writeBucket(size_t job, void *ctx)
+{
+    CLEANER *cleaner = ctx;
+    BUCKET *bucket = cleaner->buckets + job;
+    TICKET_FILE *file;
+    char tmp[PATH_MAX];
+    FILE *out;
+    bool ok;
+    for(size_t i = 0; i < bucket->count; ++i)
+    {
+        file = bucket->files + i;
+        if(file->failed || file->removed == 0)
+            continue;
+
+        if(file->removed == file->count)
+        {
+            if(unlink(file->path) != 0)
+            {
+                fprintf(stderr, "Error removing %s: %s\n", file->path, strerror(errno));
+                __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+            }
+
+            continue;
+        }
+
+        // Write to a temporary file and rename it, so the mapping stays valid and nothing gets lost on errors
+        snprintf(tmp, PATH_MAX, "%s.tmp", file->path);
+        out = fopen(tmp, "wb");
+        ok = out != NULL;
+        for(size_t j = 0; ok && j < file->count; ++j)
+            if(file->tickets[j].keep)
+                ok = fwrite(file->file.data + file->tickets[j].offset, file->tickets[j].size, 1, out) == 1;
+
+        if(out != NULL && fclose(out) != 0)
+            ok = false;
+        if(ok)
+            ok = rename(tmp, file->path) == 0;
+        if(!ok)
+        {
+            fprintf(stderr, "Error writing %s: %s\n", file->path, strerror(errno));
+            unlink(tmp);
+            __atomic_fetch_add(&cleaner->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static bool cleanTitleList(const CLEANER *cleaner, const char *path, size_t *removed)
+{
+    MAPPED_FILE file;
+    if(!mapFile(path, &file))
+    {
+        fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t count = file.size / sizeof(uint64_t);
+    uint8_t *out = malloc(file.size + 1);
+    if(out == NULL)
+    {
+        unmapFile(&file);
+        return false;
+    }
+
+    // Keep the entries as they are (including their order), just drop the ones not installed
+    size_t fill = 0;
+    uint64_t tid;
+    *removed = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        tid = readBE(file.data + i * sizeof(uint64_t), sizeof(uint64_t));
+        if(isSystemTitle(tid) || isInstalled(cleaner, tid))
+        {
+            memcpy(out + fill, file.data + i * sizeof(uint64_t), sizeof(uint64_t));
+            fill += sizeof(uint64_t);
+        }
+        else
+            ++*removed;
+    }
+
+    unmapFile(&file);
+    bool ok = true;
+    if(*removed != 0 && !cleaner->dryRun)
+    {
+        FILE *f = fopen(path, "wb");
+        ok = f != NULL && (fill == 0 || fwrite(out, fill, 1, f) == 1);
+        if(f != NULL && fclose(f) != 0)
+            ok = false;
+        if(!ok)
+            fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+    }
+
+    free(out);
+    return ok;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n] [-d] [-s] [-j threads] -i installed -b ticket/apps [-l title.list]\n", name);
+    fprintf(stderr, "  -n  dry run, just count\n");
+    fprintf(stderr, "  -d  drop byte identical DLC tickets (dlcdedupe = 1)\n");
+    fprintf(stderr, "  -s  keep the newest ticket of duplicated TIDs (select = best)\n");
+}
+
+int main(int argc, char **argv)
+{
+    CLEANER cleaner = { 0 };
+    unsigned threads = defaultThreads();
+    const char *installedPath = NULL;
+    const char *bucketPath = NULL;
+    const char *titleListPath = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "ndsj:i:b:l:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                cleaner.dryRun = true;
+                break;
+            case 'd':
+                cleaner.dlcDedupe = true;
+                break;
+            case 's':
+                cleaner.selectBest = true;
+                break;
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                if(threads == 0)
+                    threads = 1;
+                break;
+            case 'i':
+                installedPath = optarg;
+                break;
+            case 'b':
+                bucketPath = optarg;
+                break;
+            case 'l':
+                titleListPath = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(installedPath == NULL || bucketPath == NULL || optind != argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    double start = nowSeconds();
+    if(!readInstalled(&cleaner, installedPath))
+        return 1;
+
+    char **names;
+    if(!listDir(bucketPath, true, TICKET_BUCKET_NAME, &names, &cleaner.count))
+        return 1;
+
+    cleaner.buckets = calloc(cleaner.count == 0 ? 1 : cleaner.count, sizeof(BUCKET));
+    if(cleaner.buckets == NULL)
+    {
+        fprintf(stderr, "EOM!\n");
+        return 1;
+    }
+
+    for(size_t i = 0; i < cleaner.count; ++i)
+        cleaner.buckets[i].path = names[i];
+
+    runJobs(cleaner.count, threads, scanBucket, &cleaner);
+    if(cleaner.errors != 0)
+    {
+        // Just like the console we don't touch anything when the bucket couldn't be read completely
+        fprintf(stderr, "%zu errors while reading, nothing changed!\n", cleaner.errors);
+        return 2;
+    }
+
+    // Phase 2 (serial): duplicates depend on the order, so that's the only part which can't be done in parallel
+    size_t total = 0;
+    for(size_t i = 0; i < cleaner.count; ++i)
+        for(size_t j = 0; j < cleaner.buckets[i].count; ++j)
+            total += cleaner.buckets[i].files[j].count;
+
+    TID_SET handledIds = { 0 };
+    size_t dlcDuplicates = 0;
+    bool ok = cleaner.selectBest ? selectBestTickets(&cleaner, total) : tidSetInit(&handledIds, total);
+    if(ok && cleaner.dlcDedupe)
+        ok = dedupeDLC(&cleaner, total, &dlcDuplicates);
+    if(!ok)
+    {
+        fprintf(stderr, "EOM!\n");
+        return 1;
+    }
+
+    size_t deleted = 0, files = 0, changedFiles = 0;
+    TICKET_FILE *file;
+    TICKET_ENTRY *ticket;
+    for(size_t i = 0; i < cleaner.count; ++i)
+    {
+        for(size_t j = 0; j < cleaner.buckets[i].count; ++j)
+        {
+            file = cleaner.buckets[i].files + j;
+            ++files;
+            for(size_t k = 0; k < file->count; ++k)
+            {
+                ticket = file->tickets + k;
+                // Check for duplicated tickets (ignoring DLC tickets), select = best did that already
+                if(!cleaner.selectBest && ticket->keep && !isDLC(ticket->tid) && !tidSetAdd(&handledIds, ticket->tid))
+                    ticket->keep = false;
+
+                if(!ticket->keep)
+                    ++file->removed;
+            }
+
+            deleted += file->removed;
+            if(file->removed != 0)
+                ++changedFiles;
+        }
+    }
+
+    if(!cleaner.dryRun)
+        runJobs(cleaner.count, threads, writeBucket, &cleaner);
+
+    size_t removedEntries = 0;
+    if(cleaner.errors == 0 && titleListPath != NULL && !cleanTitleList(&cleaner, titleListPath, &removedEntries))
+        ++cleaner.errors;
+
+    printf("%zu tickets %s in %zu of %zu files and %zu entries %s title.list!\n", deleted, cleaner.dryRun ? "to delete" : "deleted", changedFiles, files, removedEntries, cleaner.dryRun ? "to remove from" : "removed from");
+    if(cleaner.dlcDedupe)
+        printf("%zu of them identical DLC tickets.\n", dlcDuplicates);
+    printf("Time: %.3f s (%u threads)\n", nowSeconds() - start, threads);
+
+    for(size_t i = 0; i < cleaner.count; ++i)
+    {
+        for(size_t j = 0; j < cleaner.buckets[i].count; ++j)
+        {
+            unmapFile(&cleaner.buckets[i].files[j].file);
+            free(cleaner.buckets[i].files[j].tickets);
+            free(cleaner.buckets[i].files[j].path);
+        }
+
+        free(cleaner.buckets[i].files);
+        free(cleaner.buckets[i].path);
+    }
+
+    free(handledIds.slots);
+    free(cleaner.buckets);
+    free(cleaner.installed);
+    free(names);
+    return cleaner.errors == 0 ? 0 : 2;
+}
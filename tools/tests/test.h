@@ -0,0 +1,42 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Minimal harness for the host tests: every failed expectation gets printed, main() returns testResult().
+
+#pragma once
+
+#include <stdio.h>
+
+static unsigned testChecks = 0;
+static unsigned testFailures = 0;
+
+#define EXPECT(cond)                                                              \
+    do                                                                            \
+    {                                                                             \
+        ++testChecks;                                                             \
+        if(!(cond))                                                               \
+        {                                                                         \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond);     \
+            ++testFailures;                                                       \
+        }                                                                         \
+    } while(0)
+
+static inline int testResult(const char *name)
+{
+    printf("%s: %u checks, %u failed\n", name, testChecks, testFailures);
+    return testFailures == 0 ? 0 : 1;
+}
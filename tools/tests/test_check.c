@@ -0,0 +1,140 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Host test for sortTids() and the merge join of checkConsistency()
+
+#include "test.h"
+
+#include <check.h>
+
+#include <string.h>
+
+#define MAX_TIDS 512
+
+typedef struct
+{
+    CHECK_KIND kind[MAX_TIDS * 3];
+    uint64_t tid[MAX_TIDS * 3];
+    size_t count;
+} MISMATCHES;
+
+static void recordMismatch(void *ctx, CHECK_KIND kind, uint64_t tid)
+{
+    MISMATCHES *found = ctx;
+    if(found->count < MAX_TIDS * 3)
+    {
+        found->kind[found->count] = kind;
+        found->tid[found->count++] = tid;
+    }
+}
+
+static bool contains(const uint64_t *tids, size_t count, uint64_t tid)
+{
+    return bsearch(&tid, tids, count, sizeof(uint64_t), compareTids) != NULL;
+}
+
+static void testSortTids()
+{
+    EXPECT(sortTids(NULL, 0) == 0);
+
+    uint64_t one[] = { 42 };
+    EXPECT(sortTids(one, 1) == 1 && one[0] == 42);
+
+    uint64_t tids[] = { 5, UINT64_MAX, 3, 5, 0, 3, 3, UINT64_MAX, 1 };
+    uint64_t expected[] = { 0, 1, 3, 5, UINT64_MAX };
+    size_t count = sortTids(tids, sizeof(tids) / sizeof(uint64_t));
+    EXPECT(count == sizeof(expected) / sizeof(uint64_t));
+    EXPECT(memcmp(tids, expected, sizeof(expected)) == 0);
+}
+
+static void testJoinTids()
+{
+    uint64_t tickets[] = { 1, 2, 3, 5 };
+    uint64_t list[] = { 2, 3, 4, 6 };
+    uint64_t installed[] = { 3, 4, 5, 7 };
+    MISMATCHES found = { .count = 0 };
+    joinTids(tickets, 4, list, 4, installed, 4, recordMismatch, &found);
+
+    // In TID order, a TID can show up in more than one kind
+    const CHECK_KIND kinds[] = { CHECK_NOT_INSTALLED, CHECK_NOT_INSTALLED, CHECK_NO_TICKET, CHECK_NOT_LISTED, CHECK_NO_TICKET, CHECK_NOT_LISTED };
+    const uint64_t tids[] = { 1, 2, 4, 5, 6, 7 };
+    EXPECT(found.count == 6);
+    for(size_t i = 0; i < 6 && i < found.count; ++i)
+        EXPECT(found.kind[i] == kinds[i] && found.tid[i] == tids[i]);
+
+    // Empty inputs and the largest TID, which is also the start value of the merge
+    found.count = 0;
+    joinTids(NULL, 0, NULL, 0, NULL, 0, recordMismatch, &found);
+    EXPECT(found.count == 0);
+
+    uint64_t last[] = { UINT64_MAX };
+    joinTids(last, 1, NULL, 0, last, 1, recordMismatch, &found);
+    EXPECT(found.count == 1 && found.kind[0] == CHECK_NOT_LISTED && found.tid[0] == UINT64_MAX);
+}
+
+// The merge has to find the same mismatches as looking every TID up in all three sets
+static void testJoinTidsRandom()
+{
+    uint64_t sets[3][MAX_TIDS];
+    size_t counts[3];
+    MISMATCHES found;
+    size_t expected;
+    uint64_t tid;
+    bool inTickets;
+    bool inList;
+    bool isInstalled;
+    srand(1234);
+    for(int round = 0; round < 200; ++round)
+    {
+        for(int s = 0; s < 3; ++s)
+        {
+            counts[s] = rand() % MAX_TIDS;
+            for(size_t i = 0; i < counts[s]; ++i)
+                sets[s][i] = 0x0005000010000000ULL + rand() % 300;
+
+            counts[s] = sortTids(sets[s], counts[s]);
+        }
+
+        found.count = 0;
+        joinTids(sets[0], counts[0], sets[1], counts[1], sets[2], counts[2], recordMismatch, &found);
+
+        expected = 0;
+        for(size_t i = 0; i < 300; ++i)
+        {
+            tid = 0x0005000010000000ULL + i;
+            inTickets = contains(sets[0], counts[0], tid);
+            inList = contains(sets[1], counts[1], tid);
+            isInstalled = contains(sets[2], counts[2], tid);
+            if(inList && !inTickets)
+                EXPECT(expected < found.count && found.kind[expected] == CHECK_NO_TICKET && found.tid[expected++] == tid);
+            if(isInstalled && !inList)
+                EXPECT(expected < found.count && found.kind[expected] == CHECK_NOT_LISTED && found.tid[expected++] == tid);
+            if(inTickets && !isInstalled)
+                EXPECT(expected < found.count && found.kind[expected] == CHECK_NOT_INSTALLED && found.tid[expected++] == tid);
+        }
+
+        EXPECT(expected == found.count);
+    }
+}
+
+int main()
+{
+    testSortTids();
+    testJoinTids();
+    testJoinTidsRandom();
+    return testResult("test_check");
+}
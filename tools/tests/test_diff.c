@@ -0,0 +1,193 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Host test for the index merge of diffBackups()
+
+#include "test.h"
+
+#include <diff.h>
+
+#include <stdlib.h>
+
+#define MAX_RECORDS 256
+
+typedef struct
+{
+    DIFF_KIND kind[MAX_RECORDS * 2];
+    const INDEX_RECORD *record[MAX_RECORDS * 2];
+    size_t count;
+} DIFFS;
+
+static void recordDiff(void *ctx, DIFF_KIND kind, const INDEX_RECORD *record)
+{
+    DIFFS *diffs = ctx;
+    if(diffs->count < MAX_RECORDS * 2)
+    {
+        diffs->kind[diffs->count] = kind;
+        diffs->record[diffs->count++] = record;
+    }
+}
+
+static INDEX_RECORD makeRecord(INDEX_RECORD_TYPE type, uint64_t tid, uint64_t hash)
+{
+    INDEX_RECORD record = { .tid = tid, .hash = hash, .size = 0x350, .type = type };
+    return record;
+}
+
+static void testCompare()
+{
+    INDEX_RECORD a = makeRecord(INDEX_RECORD_TICKET, 2, 9);
+    INDEX_RECORD b = makeRecord(INDEX_RECORD_TICKET, 2, 1);
+    INDEX_RECORD c = makeRecord(INDEX_RECORD_TITLE_LIST, 1, 0);
+    EXPECT(compareIndexKeys(&a, &b) == 0);
+    EXPECT(compareIndexRecords(&a, &b) > 0);
+    EXPECT(compareIndexRecords(&b, &a) < 0);
+    // The type goes first, title.list entries sort behind all tickets
+    EXPECT(compareIndexKeys(&a, &c) < 0);
+    EXPECT(compareIndexRecords(&c, &b) > 0);
+}
+
+static void testDiff()
+{
+    INDEX_RECORD from[] = {
+        makeRecord(INDEX_RECORD_TICKET, 1, 10),     // removed
+        makeRecord(INDEX_RECORD_TICKET, 2, 20),     // unchanged, two tickets
+        makeRecord(INDEX_RECORD_TICKET, 2, 21),
+        makeRecord(INDEX_RECORD_TICKET, 3, 30),     // changed hash
+        makeRecord(INDEX_RECORD_TICKET, 4, 40),     // lost a ticket
+        makeRecord(INDEX_RECORD_TICKET, 4, 41),
+        makeRecord(INDEX_RECORD_TITLE_LIST, 1, 0),  // same TID as a removed ticket, but unchanged
+    };
+    INDEX_RECORD to[] = {
+        makeRecord(INDEX_RECORD_TICKET, 2, 21),
+        makeRecord(INDEX_RECORD_TICKET, 2, 20),
+        makeRecord(INDEX_RECORD_TICKET, 3, 31),
+        makeRecord(INDEX_RECORD_TICKET, 4, 41),
+        makeRecord(INDEX_RECORD_TICKET, 5, 50),     // added
+        makeRecord(INDEX_RECORD_TITLE_LIST, 1, 0),
+        makeRecord(INDEX_RECORD_TITLE_LIST, 5, 0),  // added
+    };
+    size_t fromCount = sizeof(from) / sizeof(INDEX_RECORD);
+    size_t toCount = sizeof(to) / sizeof(INDEX_RECORD);
+    qsort(from, fromCount, sizeof(INDEX_RECORD), compareIndexRecords);
+    qsort(to, toCount, sizeof(INDEX_RECORD), compareIndexRecords);
+
+    DIFFS diffs = { .count = 0 };
+    diffIndexes(from, fromCount, to, toCount, recordDiff, &diffs);
+    const DIFF_KIND kinds[] = { DIFF_REMOVED, DIFF_CHANGED, DIFF_CHANGED, DIFF_ADDED, DIFF_ADDED };
+    const uint64_t tids[] = { 1, 3, 4, 5, 5 };
+    const uint8_t types[] = { INDEX_RECORD_TICKET, INDEX_RECORD_TICKET, INDEX_RECORD_TICKET, INDEX_RECORD_TICKET, INDEX_RECORD_TITLE_LIST };
+    EXPECT(diffs.count == 5);
+    for(size_t i = 0; i < 5 && i < diffs.count; ++i)
+        EXPECT(diffs.kind[i] == kinds[i] && diffs.record[i]->tid == tids[i] && diffs.record[i]->type == types[i]);
+
+    // Changes get reported with the record of the newer side
+    EXPECT(diffs.count > 1 && diffs.record[1] >= to && diffs.record[1] < to + toCount);
+
+    // Against an empty side everything is added or removed, once per key
+    diffs.count = 0;
+    diffIndexes(NULL, 0, to, toCount, recordDiff, &diffs);
+    EXPECT(diffs.count == 6);
+    for(size_t i = 0; i < diffs.count; ++i)
+        EXPECT(diffs.kind[i] == DIFF_ADDED);
+
+    diffs.count = 0;
+    diffIndexes(from, fromCount, NULL, 0, recordDiff, &diffs);
+    EXPECT(diffs.count == 5);
+    for(size_t i = 0; i < diffs.count; ++i)
+        EXPECT(diffs.kind[i] == DIFF_REMOVED);
+
+    diffs.count = 0;
+    diffIndexes(from, fromCount, from, fromCount, recordDiff, &diffs);
+    EXPECT(diffs.count == 0);
+}
+
+static size_t keyRecords(const INDEX_RECORD *records, size_t count, const INDEX_RECORD *key, uint64_t *hashes)
+{
+    size_t found = 0;
+    for(size_t i = 0; i < count; ++i)
+        if(compareIndexKeys(records + i, key) == 0)
+            hashes[found++] = records[i].hash;
+
+    return found;
+}
+
+// Every key has to be reported exactly as comparing its sorted hashes on both sides says
+static void testDiffRandom()
+{
+    INDEX_RECORD from[MAX_RECORDS];
+    INDEX_RECORD to[MAX_RECORDS];
+    uint64_t fromHashes[MAX_RECORDS];
+    uint64_t toHashes[MAX_RECORDS];
+    INDEX_RECORD key;
+    DIFFS diffs;
+    size_t fromCount;
+    size_t toCount;
+    size_t f;
+    size_t t;
+    size_t next;
+    bool changed;
+    srand(4321);
+    for(int round = 0; round < 300; ++round)
+    {
+        fromCount = rand() % MAX_RECORDS;
+        toCount = rand() % MAX_RECORDS;
+        for(size_t i = 0; i < fromCount; ++i)
+            from[i] = makeRecord(rand() % INDEX_RECORD_TYPES, rand() % 64, rand() % 4);
+        for(size_t i = 0; i < toCount; ++i)
+            to[i] = makeRecord(rand() % INDEX_RECORD_TYPES, rand() % 64, rand() % 4);
+
+        qsort(from, fromCount, sizeof(INDEX_RECORD), compareIndexRecords);
+        qsort(to, toCount, sizeof(INDEX_RECORD), compareIndexRecords);
+        diffs.count = 0;
+        diffIndexes(from, fromCount, to, toCount, recordDiff, &diffs);
+
+        next = 0;
+        for(int type = 0; type < INDEX_RECORD_TYPES; ++type)
+        {
+            for(uint64_t tid = 0; tid < 64; ++tid)
+            {
+                key = makeRecord(type, tid, 0);
+                f = keyRecords(from, fromCount, &key, fromHashes);
+                t = keyRecords(to, toCount, &key, toHashes);
+                if(f == 0 && t == 0)
+                    continue;
+
+                changed = f != t;
+                for(size_t i = 0; !changed && i < f; ++i)
+                    changed = fromHashes[i] != toHashes[i];
+
+                if(f == 0)
+                    EXPECT(next < diffs.count && diffs.kind[next] == DIFF_ADDED && compareIndexKeys(diffs.record[next++], &key) == 0);
+                else if(t == 0)
+                    EXPECT(next < diffs.count && diffs.kind[next] == DIFF_REMOVED && compareIndexKeys(diffs.record[next++], &key) == 0);
+                else if(changed)
+                    EXPECT(next < diffs.count && diffs.kind[next] == DIFF_CHANGED && compareIndexKeys(diffs.record[next++], &key) == 0);
+            }
+        }
+
+        EXPECT(next == diffs.count);
+    }
+}
+
+int main()
+{
+    testCompare();
+    testDiff();
+    testDiffRandom();
+    return testResult("test_diff");
+}
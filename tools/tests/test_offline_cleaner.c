@@ -0,0 +1,315 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Runs offline_cleaner on a synthetic bucket and checks what every rule leaves behind.
+// Usage: test_offline_cleaner [path/to/offline_cleaner], make -C tools test runs it from the tools directory.
+
+#include "test.h"
+#include "../host.h"
+
+#include <limits.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define TID_A   0x0005000010100000ULL // Installed, three tickets with rising versions
+#define TID_B   0x0005000010200000ULL // Installed
+#define TID_C   0x0005000010300000ULL // Installed, two tickets with the same version
+#define TID_U   0x0005000010400000ULL // Not installed
+#define TID_U2  0x0005000010500000ULL // Not installed, alone in its file
+#define TID_U3  0x0005000010600000ULL // Not installed, title.list only
+#define TID_D   0x0005000C10100000ULL // Installed DLC
+#define TID_SYS 0x0005001010040000ULL // System title, stays in title.list
+
+typedef struct
+{
+    uint8_t data[sizeof(TICKET) + 0x40];
+    size_t size;
+} TEST_TICKET;
+
+static const char *cleanerPath = "./offline_cleaner";
+
+static TEST_TICKET makeTicket(uint64_t tid, uint64_t ticketId, uint16_t version, size_t extra, uint8_t seed)
+{
+    TEST_TICKET ticket;
+    ticket.size = sizeof(TICKET) + extra;
+    for(size_t i = 0; i < ticket.size; ++i)
+        ticket.data[i] = (uint8_t)(i * 13 + seed);
+
+    writeBE(ticket.data + offsetof(TICKET, tid), tid, sizeof(uint64_t));
+    writeBE(ticket.data + offsetof(TICKET, ticket_id), ticketId, sizeof(uint64_t));
+    writeBE(ticket.data + offsetof(TICKET, title_version), version, sizeof(uint16_t));
+    writeBE(ticket.data + offsetof(TICKET, total_hdr_size), 0x14 + extra, sizeof(uint32_t));
+    return ticket;
+}
+
+static TEST_TICKET a1, a2, a3, b, ca, cb, u, u2, d, dCopy, d2;
+
+static void makeTickets()
+{
+    a1 = makeTicket(TID_A, 1, 1, 0, 1);
+    a2 = makeTicket(TID_A, 2, 2, 0, 2);
+    a3 = makeTicket(TID_A, 3, 3, 0, 3);
+    b = makeTicket(TID_B, 4, 0, 0x20, 4); // With section headers behind the fixed part
+    ca = makeTicket(TID_C, 9, 5, 0, 5);
+    cb = makeTicket(TID_C, 10, 5, 0, 6);
+    u = makeTicket(TID_U, 11, 0, 0, 7);
+    u2 = makeTicket(TID_U2, 12, 0, 0, 8);
+    d = makeTicket(TID_D, 13, 0, 0, 9);
+    dCopy = d;
+    d2 = makeTicket(TID_D, 14, 0, 0, 10); // Same TID, other bytes
+}
+
+static void writeData(const char *path, const void *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    EXPECT(f != NULL && (size == 0 || fwrite(data, size, 1, f) == 1));
+    if(f != NULL)
+        fclose(f);
+}
+
+static void writeTickets(const char *path, const TEST_TICKET *const *tickets, size_t count)
+{
+    FILE *f = fopen(path, "wb");
+    EXPECT(f != NULL);
+    for(size_t i = 0; f != NULL && i < count; ++i)
+        EXPECT(fwrite(tickets[i]->data, tickets[i]->size, 1, f) == 1);
+
+    if(f != NULL)
+        fclose(f);
+}
+
+// No tickets means the file has to be gone
+static void expectTickets(const char *path, const TEST_TICKET *const *tickets, size_t count)
+{
+    MAPPED_FILE file;
+    if(count == 0)
+    {
+        EXPECT(access(path, F_OK) != 0);
+        return;
+    }
+
+    bool mapped = mapFile(path, &file);
+    EXPECT(mapped);
+    if(!mapped)
+        return;
+
+    size_t offset = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        EXPECT(file.size - offset >= tickets[i]->size && memcmp(file.data + offset, tickets[i]->data, tickets[i]->size) == 0);
+        offset += tickets[i]->size;
+        if(offset > file.size)
+            break;
+    }
+
+    EXPECT(offset == file.size);
+    unmapFile(&file);
+}
+
+static void expectTitleList(const char *path, const uint64_t *tids, size_t count)
+{
+    MAPPED_FILE file;
+    bool mapped = mapFile(path, &file);
+    EXPECT(mapped);
+    if(!mapped)
+        return;
+
+    EXPECT(file.size == count * sizeof(uint64_t));
+    for(size_t i = 0; i < count && i * sizeof(uint64_t) < file.size; ++i)
+        EXPECT(readBE(file.data + i * sizeof(uint64_t), sizeof(uint64_t)) == tids[i]);
+
+    unmapFile(&file);
+}
+
+#define LIST(...) (const TEST_TICKET *const[]){ __VA_ARGS__ }, sizeof((const TEST_TICKET *const[]){ __VA_ARGS__ }) / sizeof(TEST_TICKET *)
+#define TIDS(...) (const uint64_t[]){ __VA_ARGS__ }, sizeof((const uint64_t[]){ __VA_ARGS__ }) / sizeof(uint64_t)
+
+static char root[64];
+static char paths[5][PATH_MAX];
+enum
+{
+    FILE_1,     // 0001/00000001.tik
+    FILE_2,     // 0001/00000002.tik
+    FILE_3,     // 0002/00000003.tik
+    TITLE_LIST,
+    INSTALLED,
+};
+
+static void createBucket()
+{
+    strcpy(root, "/tmp/offline_cleaner_XXXXXX");
+    EXPECT(mkdtemp(root) != NULL);
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/apps", root);
+    mkdir(path, 0755);
+    snprintf(path, PATH_MAX, "%s/apps/0001", root);
+    mkdir(path, 0755);
+    snprintf(path, PATH_MAX, "%s/apps/0002", root);
+    mkdir(path, 0755);
+    snprintf(path, PATH_MAX, "%s/apps/0003", root); // Empty
+    mkdir(path, 0755);
+    snprintf(path, PATH_MAX, "%s/apps/0002/notes.txt", root); // Not a ticket file name, stays untouched
+    writeData(path, "x", 1);
+
+    snprintf(paths[FILE_1], PATH_MAX, "%s/apps/0001/00000001.tik", root);
+    snprintf(paths[FILE_2], PATH_MAX, "%s/apps/0001/00000002.tik", root);
+    snprintf(paths[FILE_3], PATH_MAX, "%s/apps/0002/00000003.tik", root);
+    snprintf(paths[TITLE_LIST], PATH_MAX, "%s/title.list", root);
+    snprintf(paths[INSTALLED], PATH_MAX, "%s/installed.txt", root);
+    writeTickets(paths[FILE_1], LIST(&a1, &u, &a2, &d, &ca));
+    writeTickets(paths[FILE_2], LIST(&u2));
+    writeTickets(paths[FILE_3], LIST(&cb, &a3, &dCopy, &d2, &b));
+
+    uint8_t list[6 * sizeof(uint64_t)];
+    const uint64_t listed[] = { TID_A, TID_U, TID_SYS, TID_B, TID_U3, TID_D };
+    for(size_t i = 0; i < 6; ++i)
+        writeBE(list + i * sizeof(uint64_t), listed[i], sizeof(uint64_t));
+
+    writeData(paths[TITLE_LIST], list, sizeof(list));
+
+    // All the spellings the text format allows
+    const char *installed = "# Installed titles\n00050000-10100000\n0005000010200000\r\n0x0005000010300000\n0005000C10100000 # DLC\n";
+    writeData(paths[INSTALLED], installed, strlen(installed));
+}
+
+static void removeBucket()
+{
+    char cmd[PATH_MAX];
+    snprintf(cmd, PATH_MAX, "rm -rf %s", root);
+    EXPECT(system(cmd) == 0);
+}
+
+static int runCleaner(const char *options)
+{
+    char cmd[PATH_MAX * 4];
+    snprintf(cmd, sizeof(cmd), "%s %s -i %s -b %s/apps -l %s > /dev/null 2>&1", cleanerPath, options, paths[INSTALLED], root, paths[TITLE_LIST]);
+    int ret = system(cmd);
+    return WIFEXITED(ret) ? WEXITSTATUS(ret) : -1;
+}
+
+static void expectUntouched()
+{
+    expectTickets(paths[FILE_1], LIST(&a1, &u, &a2, &d, &ca));
+    expectTickets(paths[FILE_2], LIST(&u2));
+    expectTickets(paths[FILE_3], LIST(&cb, &a3, &dCopy, &d2, &b));
+    expectTitleList(paths[TITLE_LIST], TIDS(TID_A, TID_U, TID_SYS, TID_B, TID_U3, TID_D));
+}
+
+// Uninstalled tickets go, the first ticket of a TID in name order stays, DLC tickets all stay
+static void testDefault()
+{
+    createBucket();
+    EXPECT(runCleaner("-j 4") == 0);
+    expectTickets(paths[FILE_1], LIST(&a1, &d, &ca));
+    expectTickets(paths[FILE_2], NULL, 0);
+    expectTickets(paths[FILE_3], LIST(&dCopy, &d2, &b));
+    expectTitleList(paths[TITLE_LIST], TIDS(TID_A, TID_SYS, TID_B, TID_D));
+
+    // A second run has nothing left to do
+    EXPECT(runCleaner("-j 1") == 0);
+    expectTickets(paths[FILE_1], LIST(&a1, &d, &ca));
+    expectTickets(paths[FILE_3], LIST(&dCopy, &d2, &b));
+    removeBucket();
+}
+
+static void testDryRun()
+{
+    createBucket();
+    EXPECT(runCleaner("-n -d -s") == 0);
+    expectUntouched();
+    removeBucket();
+}
+
+// dlcdedupe = 1 drops the byte identical copy only
+static void testDLCDedupe()
+{
+    createBucket();
+    EXPECT(runCleaner("-d") == 0);
+    expectTickets(paths[FILE_1], LIST(&a1, &d, &ca));
+    expectTickets(paths[FILE_2], NULL, 0);
+    expectTickets(paths[FILE_3], LIST(&d2, &b));
+    removeBucket();
+}
+
+// select = best keeps the highest title version, then the highest ticket ID, wherever it is
+static void testSelectBest()
+{
+    createBucket();
+    EXPECT(runCleaner("-s") == 0);
+    expectTickets(paths[FILE_1], LIST(&d));
+    expectTickets(paths[FILE_2], NULL, 0);
+    expectTickets(paths[FILE_3], LIST(&cb, &a3, &dCopy, &d2, &b));
+    expectTitleList(paths[TITLE_LIST], TIDS(TID_A, TID_SYS, TID_B, TID_D));
+    removeBucket();
+
+    createBucket();
+    EXPECT(runCleaner("-s -d") == 0);
+    expectTickets(paths[FILE_1], LIST(&d));
+    expectTickets(paths[FILE_3], LIST(&cb, &a3, &d2, &b));
+    removeBucket();
+}
+
+// Like on the console nothing gets touched if a part of the bucket can't be read
+static void testBrokenFile()
+{
+    createBucket();
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/apps/0002/00000004.tik", root);
+    writeData(path, a1.data, sizeof(TICKET) / 2);
+    EXPECT(runCleaner("") == 2);
+    expectUntouched();
+    removeBucket();
+
+    // A ticket claiming more section headers than the file holds
+    createBucket();
+    snprintf(path, PATH_MAX, "%s/apps/0002/00000004.tik", root);
+    TEST_TICKET broken = makeTicket(TID_B, 20, 0, 0, 11);
+    writeBE(broken.data + offsetof(TICKET, total_hdr_size), 0x14 + 0x100, sizeof(uint32_t));
+    writeTickets(path, LIST(&broken));
+    EXPECT(runCleaner("-d -s") == 2);
+    expectUntouched();
+    removeBucket();
+
+    // An empty file
+    createBucket();
+    snprintf(path, PATH_MAX, "%s/apps/0002/00000004.tik", root);
+    writeData(path, a1.data, 0);
+    EXPECT(runCleaner("") == 2);
+    expectUntouched();
+    removeBucket();
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1)
+        cleanerPath = argv[1];
+
+    if(access(cleanerPath, X_OK) != 0)
+    {
+        fprintf(stderr, "%s not found, build it first!\n", cleanerPath);
+        return 1;
+    }
+
+    makeTickets();
+    testDefault();
+    testDryRun();
+    testDLCDedupe();
+    testSelectBest();
+    testBrokenFile();
+    return testResult("test_offline_cleaner");
+}
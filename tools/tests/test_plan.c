@@ -0,0 +1,202 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Host test for the plan checks of validatePlan(): corrupted plans have to be refused before anything gets applied
+
+#include "test.h"
+
+#include <plan.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_TICKETS 3
+
+typedef struct
+{
+    uint8_t data[1024];
+    size_t size;
+    size_t fileRecord;  // Offsets of the records
+    size_t sections;
+    size_t titleRecord;
+} PLAN;
+
+static void append(PLAN *plan, const void *data, size_t size)
+{
+    memcpy(plan->data + plan->size, data, size);
+    plan->size += size;
+}
+
+// A file with three tickets, one kept, one removed as a duplicate and one as not installed, plus two title.list entries
+static void buildPlan(PLAN *plan, const uint8_t *file, size_t fileSize)
+{
+    uint32_t magic = PLAN_MAGIC;
+    plan->size = 0;
+    append(plan, &magic, sizeof(magic));
+
+    PLAN_RECORD record = {
+        .hash = hash64(file, fileSize),
+        .type = PLAN_RECORD_FILE,
+        .size = fileSize,
+        .keptCount = 1,
+        .removedCount = 2,
+        .uninstalledCount = 1,
+        .name = "0001/00000001.tik",
+    };
+    plan->fileRecord = plan->size;
+    append(plan, &record, sizeof(record));
+
+    plan->sections = plan->size;
+    TICKET_SECTION sec;
+    for(size_t i = 0; i < FILE_TICKETS; ++i)
+    {
+        sec.offset = i * sizeof(TICKET);
+        sec.size = sizeof(TICKET);
+        append(plan, &sec, sizeof(sec));
+    }
+
+    uint64_t tid = 0x0005000010101010ULL;
+    append(plan, &tid, sizeof(tid));
+
+    memset(&record, 0, sizeof(record));
+    record.type = PLAN_RECORD_TITLE_LIST;
+    record.size = 16;
+    record.removedCount = 2;
+    plan->titleRecord = plan->size;
+    append(plan, &record, sizeof(record));
+    append(plan, &tid, sizeof(tid));
+    ++tid;
+    append(plan, &tid, sizeof(tid));
+}
+
+// checkPlan() on an exactly sized copy, so reading behind the plan would show up in sanitizer builds
+static bool check(const uint8_t *data, size_t size)
+{
+    uint8_t *copy = malloc(size == 0 ? 1 : size);
+    memcpy(copy, data, size);
+    bool ret = checkPlan(copy, size);
+    free(copy);
+    return ret;
+}
+
+static PLAN_RECORD *recordAt(PLAN *plan, size_t offset)
+{
+    return (PLAN_RECORD *)(plan->data + offset);
+}
+
+static void testValid(const PLAN *plan)
+{
+    EXPECT(check(plan->data, plan->size));
+    // A plan without anything to do is fine, too
+    EXPECT(check(plan->data, sizeof(uint32_t)));
+
+    EXPECT(planRecordCount(plan->data, plan->size) == 2);
+    EXPECT(planRecordCount(plan->data, plan->titleRecord) == 1);
+    EXPECT(planRecordCount(plan->data, sizeof(uint32_t)) == 0);
+}
+
+// Cutting the plan short only passes where a whole record ends, then the rest just doesn't get applied
+static void testTruncated(const PLAN *plan)
+{
+    for(size_t size = 0; size < plan->size; ++size)
+        EXPECT(check(plan->data, size) == (size == sizeof(uint32_t) || size == plan->titleRecord));
+}
+
+static void testCorrupted(const PLAN *good)
+{
+    PLAN plan;
+
+#define CORRUPT(change)                                \
+    do                                                 \
+    {                                                  \
+        plan = *good;                                  \
+        change;                                        \
+        EXPECT(!check(plan.data, plan.size));          \
+    } while(0)
+
+    CORRUPT(plan.data[0] ^= 1);
+    CORRUPT(recordAt(&plan, plan.fileRecord)->type = 2);
+    CORRUPT(memset(recordAt(&plan, plan.fileRecord)->name, 'A', sizeof(((PLAN_RECORD *)0)->name)));
+    CORRUPT(recordAt(&plan, plan.fileRecord)->name[0] = '\0');
+    CORRUPT(recordAt(&plan, plan.fileRecord)->removedCount = 0);
+    CORRUPT(recordAt(&plan, plan.fileRecord)->uninstalledCount = 3);
+    // Counts that would wrap a 32 bit size calculation
+    CORRUPT(recordAt(&plan, plan.fileRecord)->keptCount = UINT32_MAX);
+    CORRUPT(recordAt(&plan, plan.fileRecord)->uninstalledCount = UINT32_MAX);
+    CORRUPT(recordAt(&plan, plan.titleRecord)->removedCount = UINT32_MAX);
+    CORRUPT(recordAt(&plan, plan.titleRecord)->removedCount = 3);
+    CORRUPT(recordAt(&plan, plan.titleRecord)->keptCount = 1);
+    CORRUPT(recordAt(&plan, plan.titleRecord)->uninstalledCount = 1);
+    // Sections have to be whole tickets inside of the file
+    CORRUPT(((TICKET_SECTION *)(plan.data + plan.sections))[1].size = sizeof(TICKET) - 1);
+    CORRUPT(((TICKET_SECTION *)(plan.data + plan.sections))[2].offset += 1);
+    CORRUPT(((TICKET_SECTION *)(plan.data + plan.sections))[2].offset = SIZE_MAX);
+    CORRUPT(((TICKET_SECTION *)(plan.data + plan.sections))[0].size = SIZE_MAX);
+    CORRUPT(recordAt(&plan, plan.fileRecord)->size = FILE_TICKETS * sizeof(TICKET) - 1);
+    // A second title.list record and trailing garbage
+    CORRUPT(append(&plan, good->data + good->titleRecord, good->size - good->titleRecord));
+    CORRUPT(append(&plan, "x", 1));
+
+#undef CORRUPT
+}
+
+// Random damage may pass the structure check, but it must never make it read outside of the plan
+static void testRandomDamage(const PLAN *good)
+{
+    PLAN plan;
+    size_t passed = 0;
+    srand(99);
+    for(int round = 0; round < 100000; ++round)
+    {
+        plan = *good;
+        for(int flips = 1 + rand() % 4; flips > 0; --flips)
+            plan.data[sizeof(uint32_t) + rand() % (plan.size - sizeof(uint32_t))] ^= 1 << (rand() % 8);
+
+        passed += check(plan.data, plan.size);
+    }
+
+    // Flipped hashes and TIDs still pass, the file hash and MCP checks of validatePlan() catch those
+    EXPECT(passed != 0);
+}
+
+static void testPlannedFile(const PLAN *plan, uint8_t *file, size_t fileSize)
+{
+    const PLAN_RECORD *record = (const PLAN_RECORD *)(plan->data + plan->fileRecord);
+    EXPECT(isPlannedFile(record, file, fileSize));
+    EXPECT(!isPlannedFile(record, file, fileSize - 1));
+
+    // Same size but a different ticket, like one installed again in between
+    file[fileSize / 2] ^= 0x80;
+    EXPECT(!isPlannedFile(record, file, fileSize));
+    file[fileSize / 2] ^= 0x80;
+}
+
+int main()
+{
+    uint8_t file[FILE_TICKETS * sizeof(TICKET)];
+    for(size_t i = 0; i < sizeof(file); ++i)
+        file[i] = (uint8_t)(i * 7);
+
+    PLAN plan;
+    buildPlan(&plan, file, sizeof(file));
+    testValid(&plan);
+    testTruncated(&plan);
+    testCorrupted(&plan);
+    testRandomDamage(&plan);
+    testPlannedFile(&plan, file, sizeof(file));
+    return testResult("test_plan");
+}
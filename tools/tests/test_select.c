@@ -0,0 +1,143 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  */
+
+// Host test for the select=best passes of the cleanup. The second pass runs over every file like the fused backup does.
+
+#include "test.h"
+
+#include <select.h>
+
+#include <string.h>
+
+typedef struct
+{
+    uint16_t bucket;
+    const char *name;
+    uint64_t tid;
+    uint64_t ticketId;
+    uint16_t version;
+} TEST_TICKET;
+
+// Offsets are the position inside of the file
+static size_t ticketOffset(const TEST_TICKET *tickets, size_t i)
+{
+    size_t offset = 0;
+    for(size_t j = 0; j < i; ++j)
+        if(tickets[j].bucket == tickets[i].bucket && strcmp(tickets[j].name, tickets[i].name) == 0)
+            ++offset;
+
+    return offset;
+}
+
+static size_t selectBest(const TEST_TICKET *tickets, size_t count, uint64_t *tids, BEST_TICKET *best)
+{
+    size_t tidCount = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        size_t t = 0;
+        while(t < tidCount && tids[t] != tickets[i].tid)
+            ++t;
+
+        bool first = t == tidCount;
+        if(first)
+            tids[tidCount++] = tickets[i].tid;
+
+        offerBestTicket(best + t, first, tickets[i].bucket, tickets[i].name, ticketOffset(tickets, i), tickets[i].ticketId, tickets[i].version);
+    }
+
+    return tidCount;
+}
+
+// Returns the number of kept tickets, keep[i] is set for each of them
+static size_t cleanAll(const TEST_TICKET *tickets, size_t count, const uint64_t *tids, const BEST_TICKET *best, size_t tidCount, bool *keep)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const BEST_TICKET *b = NULL;
+        for(size_t t = 0; t < tidCount; ++t)
+            if(tids[t] == tickets[i].tid)
+                b = best + t;
+
+        keep[i] = isBestTicket(b, tickets[i].bucket, tickets[i].name, ticketOffset(tickets, i));
+        if(keep[i])
+            ++kept;
+    }
+
+    return kept;
+}
+
+static void testTicketFileKey()
+{
+    EXPECT(ticketFileKey(0x10, "0000000a") == 0x100000000aULL);
+    EXPECT(ticketFileKey(0x10, "0000000a") != ticketFileKey(0x11, "0000000a"));
+    EXPECT(ticketFileKey(0x10, "0000000a") != ticketFileKey(0x10, "0000000b"));
+}
+
+static void testSelect()
+{
+    const TEST_TICKET tickets[] = {
+        { 0x10, "00000001", 0x0005000010101A00ULL, 5, 16 },
+        { 0x10, "00000001", 0x0005000010101B00ULL, 7, 0 },
+        { 0x10, "00000002", 0x0005000010101A00ULL, 6, 32 }, // Highest version wins
+        { 0x11, "00000001", 0x0005000010101A00ULL, 9, 16 },
+        { 0x11, "00000001", 0x0005000010101B00ULL, 8, 0 }, // Same version: highest ticket ID wins
+        { 0x11, "00000002", 0x0005000010101C00ULL, 1, 0 }, // Unique
+        { 0x12, "00000001", 0x0005000010101B00ULL, 8, 0 }, // Duplicate of the winner: first one stays
+    };
+    const size_t count = sizeof(tickets) / sizeof(TEST_TICKET);
+
+    uint64_t tids[count];
+    BEST_TICKET best[count];
+    bool keep[count];
+    size_t tidCount = selectBest(tickets, count, tids, best);
+    EXPECT(tidCount == 3);
+    EXPECT(cleanAll(tickets, count, tids, best, tidCount, keep) == tidCount);
+
+    EXPECT(!keep[0]);
+    EXPECT(!keep[1]);
+    EXPECT(keep[2]);
+    EXPECT(!keep[3]);
+    EXPECT(keep[4]);
+    EXPECT(keep[5]);
+    EXPECT(!keep[6]);
+}
+
+static void testUnknownTid()
+{
+    // Tickets added after the selection pass are unknown to it and get removed
+    EXPECT(!isBestTicket(NULL, 0x10, "00000001", 0));
+
+    BEST_TICKET best;
+    offerBestTicket(&best, true, 0x10, "00000003", 2, 1, 1);
+    EXPECT(isBestTicket(&best, 0x10, "00000003", 2));
+    EXPECT(!isBestTicket(&best, 0x10, "00000003", 1));
+    EXPECT(!isBestTicket(&best, 0x13, "00000003", 2));
+
+    // Not better: lower version or same version with a lower ticket ID
+    offerBestTicket(&best, false, 0x10, "00000004", 0, 2, 0);
+    offerBestTicket(&best, false, 0x10, "00000004", 1, 0, 1);
+    EXPECT(isBestTicket(&best, 0x10, "00000003", 2));
+}
+
+int main()
+{
+    testTicketFileKey();
+    testSelect();
+    testUnknownTid();
+    return testResult("test_select");
+}
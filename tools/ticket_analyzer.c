@@ -0,0 +1,456 @@
+/***************************************************************************
+ * This file is part of Ticket Cleaner.                                    *
+ * Copyright (c) 2022 V10lator <v10lator@myway.de>                         *
+ *                                                                         *
+ * This program is free software; you can redistribute it and/or modify    *
+ * it under the terms of the GNU General Public License as published by    *
+ * the Free Software Foundation; either version 3 of the License, or       *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU General Public License for more details.                            *
+ *                                                                         *
+ * You should have received a copy of the GNU General Public License along *
+ * with this program; if not, If not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+
+// Native tool indexing backup slots (as written by backupTickets()) collected from many consoles.
+// Usage: ticket_analyzer [-j threads] [-o index.tsv] <dir>...
+// Every directory is searched recursively for slots, a slot being a folder containing a title.list.
+
+#include "host.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+
+typedef struct
+{
+    uint64_t tid;
+    uint64_t ticketId;
+    uint32_t deviceId;
+    uint32_t accountId;
+    uint32_t size;
+    uint32_t slot;
+    uint16_t titleVersion;
+} TICKET_RECORD;
+
+typedef struct
+{
+    char *path;
+    TICKET_RECORD *records;
+    size_t count;
+    size_t capacity;
+    size_t files;
+    size_t bytes;
+    size_t errors;
+    size_t titleListEntries;
+} SLOT;
+
+typedef struct
+{
+    SLOT *slots;
+    size_t count;
+    size_t capacity;
+} SLOT_LIST;
+
+static bool addSlot(SLOT_LIST *list, const char *path)
+{
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        SLOT *slots = realloc(list->slots, sizeof(SLOT) * capacity);
+        if(slots == NULL)
+            return false;
+
+        list->slots = slots;
+        list->capacity = capacity;
+    }
+
+    SLOT *slot = list->slots + list->count;
+    memset(slot, 0, sizeof(SLOT));
+    slot->path = strdup(path);
+    if(slot->path == NULL)
+        return false;
+
+    ++list->count;
+    return true;
+}
+
+static bool findSlots(SLOT_LIST *list, const char *path)
+{
+    char sub[PATH_MAX];
+    struct stat st;
+    snprintf(sub, PATH_MAX, "%s/title.list", path);
+    if(stat(sub, &st) == 0 && S_ISREG(st.st_mode))
+        return addSlot(list, path);
+
+    DIR *dir = opendir(path);
+    if(dir == NULL)
+        return true;
+
+    bool ret = true;
+    struct dirent *entry;
+    while(ret && (entry = readdir(dir)) != NULL)
+    {
+        if(entry->d_name[0] == '.')
+            continue;
+
+        snprintf(sub, PATH_MAX, "%s/%s", path, entry->d_name);
+        if(stat(sub, &st) == 0 && S_ISDIR(st.st_mode))
+            ret = findSlots(list, sub);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+static bool addRecord(SLOT *slot, const uint8_t *ticket, uint32_t size, uint32_t index)
+{
+    if(slot->count == slot->capacity)
+    {
+        size_t capacity = slot->capacity == 0 ? 256 : slot->capacity * 2;
+        TICKET_RECORD *records = realloc(slot->records, sizeof(TICKET_RECORD) * capacity);
+        if(records == NULL)
+            return false;
+
+        slot->records = records;
+        slot->capacity = capacity;
+    }
+
+    TICKET_RECORD *record = slot->records + slot->count++;
+    record->tid = TICKET_FIELD(ticket, tid);
+    record->ticketId = TICKET_FIELD(ticket, ticket_id);
+    record->deviceId = TICKET_FIELD(ticket, device_id);
+    record->accountId = TICKET_FIELD(ticket, account_id);
+    record->titleVersion = TICKET_FIELD(ticket, title_version);
+    record->size = size;
+    record->slot = index;
+    return true;
+}
+
+static void scanTicketFile(SLOT *slot, const char *path, uint32_t index)
+{
+    MAPPED_FILE file;
+    if(!mapFile(path, &file))
+    {
+        ++slot->errors;
+        return;
+    }
+
+    ++slot->files;
+    slot->bytes += file.size;
+
+    const uint8_t *end = file.data + file.size;
+    const uint8_t *ptr;
+    for(const uint8_t *ticket = file.data; ticket != end; ticket = ptr)
+    {
+        ptr = nextTicket(ticket, end);
+        if(ptr == NULL)
+        {
+            fprintf(stderr, "Filesize missmatch at %s!\n", path);
+            ++slot->errors;
+            break;
+        }
+
+        if(!addRecord(slot, ticket, ptr - ticket, index))
+        {
+            ++slot->errors;
+            break;
+        }
+    }
+
+    unmapFile(&file);
+}
+
+static void scanSlot(size_t job, void *ctx)
+{
+    SLOT *slot = ((SLOT_LIST *)ctx)->slots + job;
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/title.list", slot->path);
+    MAPPED_FILE file;
+    if(mapFile(path, &file))
+    {
+        slot->titleListEntries = file.size / sizeof(uint64_t);
+        unmapFile(&file);
+    }
+    else
+        ++slot->errors;
+
+    DIR *dir = opendir(slot->path);
+    if(dir == NULL)
+    {
+        ++slot->errors;
+        return;
+    }
+
+    // Loop through all the buckets of the slot
+    struct dirent *entry;
+    DIR *dir2;
+    struct dirent *entry2;
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(!isHexName(entry->d_name, TICKET_BUCKET_NAME))
+            continue;
+
+        snprintf(path, PATH_MAX, "%s/%s", slot->path, entry->d_name);
+        dir2 = opendir(path);
+        if(dir2 == NULL)
+            continue;
+
+        size_t len = strlen(path);
+        while((entry2 = readdir(dir2)) != NULL)
+        {
+            if(entry2->d_name[0] == '.' || strlen(entry2->d_name) != TICKET_FILE_NAME)
+                continue;
+
+            snprintf(path + len, PATH_MAX - len, "/%s", entry2->d_name);
+            scanTicketFile(slot, path, job);
+        }
+
+        closedir(dir2);
+    }
+
+    closedir(dir);
+}
+
+static int compareByTid(const void *a, const void *b)
+{
+    const TICKET_RECORD *ra = a;
+    const TICKET_RECORD *rb = b;
+    if(ra->tid != rb->tid)
+        return ra->tid < rb->tid ? -1 : 1;
+    if(ra->slot != rb->slot)
+        return ra->slot < rb->slot ? -1 : 1;
+
+    return 0;
+}
+
+static int compareByDevice(const void *a, const void *b)
+{
+    const TICKET_RECORD *ra = a;
+    const TICKET_RECORD *rb = b;
+    if(ra->deviceId != rb->deviceId)
+        return ra->deviceId < rb->deviceId ? -1 : 1;
+    if(ra->slot != rb->slot)
+        return ra->slot < rb->slot ? -1 : 1;
+
+    return 0;
+}
+
+static int compareByAccount(const void *a, const void *b)
+{
+    const TICKET_RECORD *ra = a;
+    const TICKET_RECORD *rb = b;
+    return ra->accountId == rb->accountId ? 0 : (ra->accountId < rb->accountId ? -1 : 1);
+}
+
+static int compareU32(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a;
+    uint32_t ub = *(const uint32_t *)b;
+    return ua == ub ? 0 : (ua < ub ? -1 : 1);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-o index.tsv] <dir>...\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = defaultThreads();
+    const char *indexPath = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "j:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                threads = strtoul(optarg, NULL, 10);
+                if(threads == 0)
+                    threads = 1;
+                break;
+            case 'o':
+                indexPath = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(optind == argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    double start = nowSeconds();
+    SLOT_LIST slots = { 0 };
+    for(int i = optind; i < argc; ++i)
+    {
+        if(!findSlots(&slots, argv[i]))
+        {
+            fprintf(stderr, "EOM!\n");
+            return 1;
+        }
+    }
+
+    if(slots.count == 0)
+    {
+        fprintf(stderr, "No backup slots found!\n");
+        return 1;
+    }
+
+    runJobs(slots.count, threads, scanSlot, &slots);
+
+    size_t total = 0, files = 0, bytes = 0, errors = 0, titleListEntries = 0;
+    for(size_t i = 0; i < slots.count; ++i)
+    {
+        total += slots.slots[i].count;
+        files += slots.slots[i].files;
+        bytes += slots.slots[i].bytes;
+        errors += slots.slots[i].errors;
+        titleListEntries += slots.slots[i].titleListEntries;
+    }
+
+    TICKET_RECORD *records = malloc(sizeof(TICKET_RECORD) * (total == 0 ? 1 : total));
+    uint32_t *devices = malloc(sizeof(uint32_t) * (total == 0 ? 1 : total));
+    if(records == NULL || devices == NULL)
+    {
+        fprintf(stderr, "EOM!\n");
+        return 1;
+    }
+
+    total = 0;
+    for(size_t i = 0; i < slots.count; ++i)
+    {
+        memcpy(records + total, slots.slots[i].records, sizeof(TICKET_RECORD) * slots.slots[i].count);
+        total += slots.slots[i].count;
+        free(slots.slots[i].records);
+    }
+
+    FILE *index = NULL;
+    if(indexPath != NULL)
+    {
+        index = fopen(indexPath, "w");
+        if(index == NULL)
+        {
+            fprintf(stderr, "Error opening %s\n", indexPath);
+            return 1;
+        }
+
+        fprintf(index, "tid\ttickets\tslots\tdevices\tmin_version\tmax_version\tbytes\n");
+    }
+
+    // Per TID statistics. Records are sorted by TID and slot, so everything can be done in a single sweep.
+    qsort(records, total, sizeof(TICKET_RECORD), compareByTid);
+    size_t tids = 0, dlcTids = 0, dupTids = 0, dupTickets = 0, sharedTids = 0;
+    for(size_t i = 0, j; i < total; i = j)
+    {
+        size_t slotCount = 1, deviceCount = 0, size = 0;
+        uint16_t minVersion = records[i].titleVersion, maxVersion = minVersion;
+        bool duplicated = false;
+        for(j = i; j < total && records[j].tid == records[i].tid; ++j)
+        {
+            if(j != i)
+            {
+                if(records[j].slot == records[j - 1].slot)
+                {
+                    // Same as deleteTickets(): multiple DLC tickets per TID are legit
+                    if(!isDLC(records[j].tid))
+                    {
+                        duplicated = true;
+                        ++dupTickets;
+                    }
+                }
+                else
+                    ++slotCount;
+            }
+
+            if(records[j].titleVersion < minVersion)
+                minVersion = records[j].titleVersion;
+            if(records[j].titleVersion > maxVersion)
+                maxVersion = records[j].titleVersion;
+            if(records[j].deviceId != 0)
+                devices[deviceCount++] = records[j].deviceId;
+
+            size += records[j].size;
+        }
+
+        qsort(devices, deviceCount, sizeof(uint32_t), compareU32);
+        size_t uniqueDevices = deviceCount == 0 ? 0 : 1;
+        for(size_t k = 1; k < deviceCount; ++k)
+            if(devices[k] != devices[k - 1])
+                ++uniqueDevices;
+
+        ++tids;
+        if(isDLC(records[i].tid))
+            ++dlcTids;
+        if(duplicated)
+            ++dupTids;
+        if(uniqueDevices > 1)
+            ++sharedTids;
+
+        if(index != NULL)
+            fprintf(index, "%016" PRIX64 "\t%zu\t%zu\t%zu\t%u\t%u\t%zu\n", records[i].tid, j - i, slotCount, uniqueDevices, minVersion, maxVersion, size);
+    }
+
+    // Per device statistics
+    if(index != NULL)
+        fprintf(index, "\ndevice_id\ttickets\tslots\n");
+
+    qsort(records, total, sizeof(TICKET_RECORD), compareByDevice);
+    size_t deviceIds = 0, commonTickets = 0;
+    for(size_t i = 0, j; i < total; i = j)
+    {
+        size_t slotCount = 1;
+        for(j = i + 1; j < total && records[j].deviceId == records[i].deviceId; ++j)
+            if(records[j].slot != records[j - 1].slot)
+                ++slotCount;
+
+        if(records[i].deviceId == 0)
+        {
+            commonTickets = j - i;
+            continue;
+        }
+
+        ++deviceIds;
+        if(index != NULL)
+            fprintf(index, "%08" PRIX32 "\t%zu\t%zu\n", records[i].deviceId, j - i, slotCount);
+    }
+
+    qsort(records, total, sizeof(TICKET_RECORD), compareByAccount);
+    size_t accountIds = 0;
+    for(size_t i = 0; i < total; ++i)
+        if(records[i].accountId != 0 && (i == 0 || records[i].accountId != records[i - 1].accountId))
+            ++accountIds;
+
+    if(index != NULL)
+        fclose(index);
+
+    printf("Slots:              %zu\n", slots.count);
+    printf("Ticket files:       %zu (%zu bytes)\n", files, bytes);
+    printf("Tickets:            %zu (%zu personalized, %zu common)\n", total, total - commonTickets, commonTickets);
+    printf("title.list entries: %zu\n", titleListEntries);
+    printf("Unique TIDs:        %zu (%zu DLC)\n", tids, dlcTids);
+    printf("Duplicated TIDs:    %zu (%zu surplus tickets)\n", dupTids, dupTickets);
+    printf("TIDs on >1 device:  %zu\n", sharedTids);
+    printf("Device IDs:         %zu\n", deviceIds);
+    printf("Account IDs:        %zu\n", accountIds);
+    printf("Errors:             %zu\n", errors);
+    printf("Time:               %.3f s (%u threads)\n", nowSeconds() - start, threads);
+
+    for(size_t i = 0; i < slots.count; ++i)
+        free(slots.slots[i].path);
+
+    free(slots.slots);
+    free(devices);
+    free(records);
+    return errors == 0 ? 0 : 2;
+}